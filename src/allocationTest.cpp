@@ -0,0 +1,159 @@
+// Copyright (c) 2022 Dániel Gergely, Dénes Balogh
+// Distributed under the MIT License.
+
+#define NODE_VERSION "axolotl_alpha"
+
+#include <new>
+
+#include "cli/common.hpp"
+#include "networking/common.hpp"
+using namespace cli;
+
+// every allocation of the process is counted
+// all forms of new and delete are replaced together, so every block goes back to the allocator it came from
+std::atomic<size_t> allocationCount = 0;
+
+// returns nullptr if there is no memory left
+void* allocate(size_t size, size_t alignment = alignof(std::max_align_t)) noexcept {
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    size = size ? size : 1;
+    if (alignment <= alignof(std::max_align_t)) return std::malloc(size);
+    // aligned_alloc needs a size that is a multiple of the alignment
+    return std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+}
+
+void* allocateOrThrow(size_t size, size_t alignment = alignof(std::max_align_t)) {
+    void* block = allocate(size, alignment);
+    if (!block) throw std::bad_alloc();
+    return block;
+}
+
+void* operator new(size_t size) { return allocateOrThrow(size); }
+void* operator new[](size_t size) { return allocateOrThrow(size); }
+void* operator new(size_t size, std::align_val_t alignment) { return allocateOrThrow(size, size_t(alignment)); }
+void* operator new[](size_t size, std::align_val_t alignment) { return allocateOrThrow(size, size_t(alignment)); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept { return allocate(size); }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept { return allocate(size); }
+void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept { return allocate(size, size_t(alignment)); }
+void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept { return allocate(size, size_t(alignment)); }
+
+void operator delete(void* block) noexcept { std::free(block); }
+void operator delete[](void* block) noexcept { std::free(block); }
+void operator delete(void* block, size_t) noexcept { std::free(block); }
+void operator delete[](void* block, size_t) noexcept { std::free(block); }
+void operator delete(void* block, std::align_val_t) noexcept { std::free(block); }
+void operator delete[](void* block, std::align_val_t) noexcept { std::free(block); }
+void operator delete(void* block, size_t, std::align_val_t) noexcept { std::free(block); }
+void operator delete[](void* block, size_t, std::align_val_t) noexcept { std::free(block); }
+void operator delete(void* block, const std::nothrow_t&) noexcept { std::free(block); }
+void operator delete[](void* block, const std::nothrow_t&) noexcept { std::free(block); }
+void operator delete(void* block, std::align_val_t, const std::nothrow_t&) noexcept { std::free(block); }
+void operator delete[](void* block, std::align_val_t, const std::nothrow_t&) noexcept { std::free(block); }
+
+enum class pT : uint8_t {
+    nodeValidation,
+    textMessage
+};
+
+typedef ValidationPacket<pT::nodeValidation> NodeValidation;
+struct TextMessage : VariablePacket<pT::textMessage, 0, 256> {};
+typedef PacketRegistry<pT, NodeValidation, TextMessage> pR;
+
+class Node : public Endpoint<pR, Node> {
+    public:
+        using Endpoint::Endpoint;
+        size_t received = 0;
+
+        void onMessage(TextMessage, MetaPacket<pR>& packet) {
+            received++;
+        }
+};
+
+// packets sent before waiting for all of them to arrive, so the number of packets under way is the same every round
+const size_t window = 256;
+
+// sends a window of packets from 'sender' over 'conn' and runs the loop until 'receiver' handled all of them
+void round(io_context& loop, Node& sender, Node& receiver, std::shared_ptr<Connection<pR>>& conn) {
+    size_t target = receiver.received + window;
+    for (size_t i = 0; i < window; i++) {
+        Packet<pR> packet;
+        packet.header.packetType = pT::textMessage;
+        packet.body = sender.bufferPool.acquire(64);
+        PacketWriter<pR>(packet).write(std::string_view("hello there, this is a chat message"));
+        conn->send(std::move(packet));
+    }
+    while (receiver.received < target) loop.run_one();
+}
+
+// the send and receive paths of two endpoints embedded in one loop, once warmed up they must not allocate,
+// and a closed or evicted connection must be freed
+int main() {
+    print::setLogLevel(print::logLevels::info);
+    bool passed = true;
+    io_context loop;
+    char keyA[5] = "aaaa";
+    char keyB[5] = "bbbb";
+    Node a(loop, keyA, 4601);
+    Node b(loop, keyB, 4602);
+    a.start();
+    b.start();
+
+    std::shared_ptr<Connection<pR>> conn;
+    b.connect("127.0.0.1", 4601, [&conn] (std::shared_ptr<Connection<pR>> _conn) { conn = _conn; });
+    while (!conn || a.connections.count() == 0) loop.run_one();
+
+    for (size_t i = 0; i < 16; i++) round(loop, b, a, conn);
+    size_t before = allocationCount;
+    for (size_t i = 0; i < 256; i++) round(loop, b, a, conn);
+    size_t allocations = allocationCount - before;
+    print::info(std::to_string(256 * window) + " packets after warm-up, " + std::to_string(allocations) + " allocations");
+    if (allocations > 0) {
+        print::error("the steady state send and receive paths allocated");
+        passed = false;
+    }
+
+    // both ends of a closed connection are freed once the endpoints let go of them
+    std::weak_ptr<Connection<pR>> localEnd = conn;
+    std::weak_ptr<Connection<pR>> remoteEnd = a.connections.get(keyB)->connection;
+    conn->disconnect();
+    conn.reset();
+    loop.run_for(std::chrono::milliseconds(200));
+    if (!localEnd.expired() || !remoteEnd.expired()) {
+        print::error("a closed connection was not freed");
+        passed = false;
+    }
+
+    // an idle connection is evicted once its queued packets are written, then both of its ends are freed
+    conn.reset();
+    b.connect("127.0.0.1", 4601, [&conn] (std::shared_ptr<Connection<pR>> _conn) { conn = _conn; });
+    while (!conn || !a.connections.get(keyB)->connection) loop.run_one();
+    localEnd = conn;
+    remoteEnd = a.connections.get(keyB)->connection;
+    a.connectionManager.idleTimeout = std::chrono::milliseconds(50);
+    loop.run_for(std::chrono::milliseconds(100));
+    Packet<pR> packet;
+    packet.header.packetType = pT::textMessage;
+    PacketWriter<pR>(packet).write(std::string_view("written before the eviction"));
+    size_t target = b.received + 1;
+    remoteEnd.lock()->send(std::move(packet));
+    a.connectionManager.sweep();
+    while (b.received < target) loop.run_one();
+    if (a.connectionManager.idleEvictions > 0) {
+        print::error("a connection with queued packets was evicted");
+        passed = false;
+    }
+    // writing the packet made the connection active again
+    loop.run_for(std::chrono::milliseconds(100));
+    a.connectionManager.sweep();
+    conn.reset();
+    loop.run_for(std::chrono::milliseconds(200));
+    if (a.connectionManager.idleEvictions != 1 || !localEnd.expired() || !remoteEnd.expired()) {
+        print::error("an evicted connection was not freed");
+        passed = false;
+    }
+
+    a.stop();
+    b.stop();
+    print::info(passed ? "passed" : "failed");
+    return passed ? 0 : 1;
+}
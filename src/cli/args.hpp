@@ -9,6 +9,11 @@ uint16_t REMOTE_PORT{};
 char PUBLIC_KEY[5]{};
 std::string REMOTE_IP{};
 char REMOTE_PUBLIC_KEY[5]{};
+size_t IO_THREADS = 1;
+bool PIN_IO_THREADS = false;
+std::string SCRIPT_PATH{};
+bool REMOTE_IS_PARENT = false;
+std::string PEER_CACHE_PATH{};
 
 namespace cli {
     void parseArgs(int32_t argCount, char* args[]) {
@@ -38,6 +43,27 @@ namespace cli {
                 std::strcpy(PUBLIC_KEY, args[i + 1]);
                 i++;
             }
+            else if (!std::strcmp(args[i], "--iothreads") || !std::strcmp(args[i], "-T")) {
+                if (i + 1 >= argCount || args[i + 1][0] == '-') cli::help();
+                IO_THREADS = std::max(1, atoi(args[i + 1]));
+                i++;
+            }
+            else if (!std::strcmp(args[i], "--script") || !std::strcmp(args[i], "-S")) {
+                if (i + 1 >= argCount || (args[i + 1][0] == '-' && args[i + 1][1] != 0)) cli::help();
+                SCRIPT_PATH = args[i + 1];
+                i++;
+            }
+            else if (!std::strcmp(args[i], "--peers")) {
+                if (i + 1 >= argCount || args[i + 1][0] == '-') cli::help();
+                PEER_CACHE_PATH = args[i + 1];
+                i++;
+            }
+            else if (!std::strcmp(args[i], "--parent")) {
+                REMOTE_IS_PARENT = true;
+            }
+            else if (!std::strcmp(args[i], "--pin")) {
+                PIN_IO_THREADS = true;
+            }
             else if (!std::strcmp(args[i], "--help") || !std::strcmp(args[i], "-H")) {
                 cli::help();
             }
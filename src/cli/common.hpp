@@ -9,6 +9,7 @@
 #include <sstream>
 #include <vector>
 #include <cstring>
+#include <algorithm>
 
 #include "print.hpp"
 #include "help.hpp"
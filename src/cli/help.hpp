@@ -14,6 +14,12 @@ namespace cli {
             "-I, --remoteip <addr>  Target server IP, defaults to 42069",
             "-P, --remoteport <int> Target server port, defaults to 42069",
             "-K, --publickey <str>  Public key of node for identification (4 chars)",
+            "-T, --iothreads <int>  Number of io threads, defaults to 1",
+            "    --pin              Pin each io thread to its own cpu",
+            "    --parent           Use the remote node as parent, unknown nodes are looked up through it",
+            "    --peers <path>     Remember known peers in this file and reconnect to them on startup",
+            "-S, --script <path>    Send each line of a file or pipe (- for stdin) to the remote node",
+            "                       as fast as possible, instead of reading messages interactively",
             "",
             "Examples:",
             "",
@@ -22,6 +28,9 @@ namespace cli {
             "",
             "Start a node on port 4202, then connect to localhost:4201 and send an example message:",
             "./axolotl -L 4202 -K qwer -I localhost -P 4201",
+            "",
+            "Start a node on port 4203, then send the lines of messages.txt to localhost:4201:",
+            "./axolotl -L 4203 -K zxcv -I localhost -P 4201 -S messages.txt",
             ""
         };
         for (std::string i : txt) std::cout << i << std::endl;
@@ -40,6 +40,11 @@ namespace cli::print {
         GLOBAL_LOG_LEVEL = level;
     }
 
+    // lets hot paths skip building messages that would not be printed
+    bool isEnabled (logLevels level) {
+        return GLOBAL_LOG_LEVEL >= level;
+    }
+
     template <typename T> void buffer (colors color, T data, modifiers modifier = reset) {
         std::cout << "\033[" << modifier << ";" << color << "m" << data << "\033[0m";
     }
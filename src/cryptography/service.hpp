@@ -0,0 +1,162 @@
+// Copyright (c) 2022 Dániel Gergely, Dénes Balogh
+// Distributed under the MIT License.
+
+#pragma once
+// the service hands its results over through asio, so it needs the networking module as well
+#include "../networking/common.hpp"
+#include "common.hpp"
+
+// jobs the crypto service accepts before it starts refusing new ones
+const size_t DEFAULT_CRYPTO_QUEUE_SIZE = 1024;
+
+// a message encrypted with a one-time AES key, the key is encrypted with the public key of the recipient
+// and signed with the private key of the sender
+struct SealedMessage {
+    std::string cipherKey;
+    std::string cipherText;
+    std::string signature;
+    AES::InitVector iv;
+};
+
+// runs the RSA and AES operations on its own threads, so handlers and io threads are never blocked by them
+// results are delivered on the executor associated with the completion handler (the caller's coroutine
+// with 'use_awaitable', or the one given with 'bind_executor'), plain handlers run on the crypto threads
+// a full queue completes the operation right away with 'would_block'
+class CryptoService {
+    private:
+        thread_pool pool;
+        // jobs waiting or under processing
+        std::atomic<size_t> queuedJobs = 0;
+        size_t maxQueuedJobs;
+
+    public:
+        CryptoService(
+            size_t threads = std::max(1u, std::thread::hardware_concurrency()),
+            size_t _maxQueuedJobs = DEFAULT_CRYPTO_QUEUE_SIZE
+        ) : pool(threads), maxQueuedJobs(_maxQueuedJobs) {}
+        CryptoService(const CryptoService&) = delete;
+
+        virtual ~CryptoService() {
+            pool.stop();
+            pool.join();
+        }
+
+        size_t pending() const {
+            return queuedJobs;
+        }
+
+        // async - completes with the signature of the text
+        template <typename tokenT = use_awaitable_t<>> auto asyncSign(
+            std::string plainText,
+            RSA::PrivateKey privateKey,
+            tokenT&& token = {}
+        ) {
+            return submit<std::string>(
+                std::forward<tokenT>(token),
+                [plainText = std::move(plainText), privateKey = std::move(privateKey)] (boost::system::error_code& ec) {
+                    return RSA::Sign(plainText, privateKey);
+                }
+            );
+        }
+
+        // async - completes with whether the signature of the text is valid
+        template <typename tokenT = use_awaitable_t<>> auto asyncVerify(
+            std::string signature,
+            std::string plainText,
+            RSA::PublicKey publicKey,
+            tokenT&& token = {}
+        ) {
+            return submit<bool>(
+                std::forward<tokenT>(token),
+                [signature = std::move(signature), plainText = std::move(plainText), publicKey = std::move(publicKey)] (
+                    boost::system::error_code& ec
+                ) {
+                    return RSA::Verify(signature, plainText, publicKey);
+                }
+            );
+        }
+
+        // async - encrypts the text for the recipient and signs it as the sender
+        template <typename tokenT = use_awaitable_t<>> auto asyncSeal(
+            std::string plainText,
+            RSA::PublicKey recipientKey,
+            RSA::PrivateKey senderKey,
+            tokenT&& token = {}
+        ) {
+            return submit<SealedMessage>(
+                std::forward<tokenT>(token),
+                [plainText = std::move(plainText), recipientKey = std::move(recipientKey), senderKey = std::move(senderKey)] (
+                    boost::system::error_code& ec
+                ) {
+                    SealedMessage message;
+                    AES::Key key = AES::GenerateKey();
+                    message.iv = AES::GenerateInitVector();
+                    message.cipherKey = RSA::EncryptKey(key, recipientKey);
+                    message.cipherText = AES::Encrypt(plainText, key, message.iv);
+                    message.signature = RSA::SignKey(key, senderKey);
+                    return message;
+                }
+            );
+        }
+
+        // async - decrypts a sealed message as its recipient
+        // fails with 'bad_message' if the signature of the sender or the integrity of the text is invalid
+        template <typename tokenT = use_awaitable_t<>> auto asyncOpen(
+            SealedMessage message,
+            RSA::PrivateKey recipientKey,
+            RSA::PublicKey senderKey,
+            tokenT&& token = {}
+        ) {
+            return submit<std::string>(
+                std::forward<tokenT>(token),
+                [message = std::move(message), recipientKey = std::move(recipientKey), senderKey = std::move(senderKey)] (
+                    boost::system::error_code& ec
+                ) {
+                    AES::Key key = RSA::DecryptKey(message.cipherKey, recipientKey);
+                    bool isValid = RSA::VerifyKey(message.signature, key, senderKey);
+                    std::string plainText;
+                    if (isValid) plainText = AES::Decrypt(message.cipherText, key, message.iv, isValid);
+                    if (!isValid) {
+                        ec = make_error_code(boost::system::errc::bad_message);
+                        return std::string();
+                    }
+                    return plainText;
+                }
+            );
+        }
+
+    private:
+        // runs 'job' on the pool and completes the handler with its result
+        // the job reports failures through the error code, exceptions of CryptoPP are turned into one too
+        template <typename resultT, typename tokenT, typename jobT> auto submit(tokenT&& token, jobT&& job) {
+            return async_initiate<tokenT, void(boost::system::error_code, resultT)>(
+                [this] (auto handler, std::decay_t<jobT> job) {
+                    any_io_executor fallback = pool.get_executor();
+                    if (queuedJobs++ >= maxQueuedJobs) {
+                        queuedJobs--;
+                        completeOn(fallback, std::move(handler), make_error_code(error::would_block), resultT());
+                        return;
+                    }
+                    // keeps the executor of the caller running until the result arrives
+                    auto work = make_work_guard(get_associated_executor(handler, fallback));
+                    post(
+                        pool,
+                        [this, handler = std::move(handler), job = std::move(job), work = std::move(work), fallback] () mutable {
+                            boost::system::error_code ec;
+                            resultT result{};
+                            try {
+                                result = job(ec);
+                            } catch (CryptoPP::Exception& e) {
+                                print::error(std::string("CryptoService - error: ") + e.what());
+                                ec = make_error_code(boost::system::errc::bad_message);
+                            }
+                            queuedJobs--;
+                            completeOn(fallback, std::move(handler), ec, std::move(result));
+                        }
+                    );
+                },
+                token,
+                std::forward<jobT>(job)
+            );
+        }
+};
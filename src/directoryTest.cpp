@@ -0,0 +1,102 @@
+// Copyright (c) 2022 Dániel Gergely, Dénes Balogh
+// Distributed under the MIT License.
+
+#define NODE_VERSION "axolotl_alpha"
+
+#include "cli/common.hpp"
+#include "networking/common.hpp"
+using namespace cli;
+
+enum class pT : uint8_t {
+    nodeValidation,
+    directoryQuery,
+    directoryAnswer,
+    directoryRegister
+};
+
+typedef PacketRegistry<
+    pT,
+    ValidationPacket<pT::nodeValidation>,
+    DirectoryQueryPacket<pT::directoryQuery>,
+    DirectoryAnswerPacket<pT::directoryAnswer>,
+    DirectoryRegisterPacket<pT::directoryRegister>
+> pR;
+
+const size_t capacity = 1024;
+
+// the i-th public key, 4 printable characters like the keys of the nodes
+NodeKey keyOf(size_t i) {
+    char publicKey[5];
+    for (size_t j = 0; j < 4; j++) {
+        publicKey[j] = char(33 + i % 94);
+        i /= 94;
+    }
+    publicKey[4] = '\0';
+    return NodeKey(publicKey);
+}
+
+// the parent of the directory answers every query right away, the i-th node is found at port i
+void answerQueries(Directory<pR>& directory, std::vector<DirectoryQueryPayload>& sent) {
+    for (DirectoryQueryPayload& query : sent) {
+        DirectoryAnswerPayload answer = {};
+        answer.queryId = query.queryId;
+        std::memcpy(answer.target, query.target, sizeof(answer.target));
+        answer.found = 1;
+        std::memcpy(answer.contact.publicKey, query.target, sizeof(answer.contact.publicKey));
+        std::strcpy(answer.contact.ipAddress, "10.0.0.1");
+        answer.contact.port = 4000;
+        directory.onAnswer(answer);
+    }
+    sent.clear();
+}
+
+// the answer cache of the directory is filled past its capacity, it has to stay bounded
+// and keep the answers cached the most recently
+int main() {
+    print::setLogLevel(print::logLevels::info);
+    bool passed = true;
+    io_context loop;
+    Directory<pR> directory(loop);
+    directory.cacheCapacity = capacity;
+    std::vector<DirectoryQueryPayload> sent;
+    directory.sendToParent = [&sent] (Packet<pR> packet, std::function<void()> fail) {
+        DirectoryQueryPayload query;
+        PacketReader<pR> reader(packet);
+        reader >> query;
+        sent.push_back(query);
+    };
+
+    size_t found = 0;
+    auto count = [&found] (std::optional<DHTContact> contact) { found += contact.has_value(); };
+    for (size_t i = 0; i < 4 * capacity; i++) {
+        directory.lookup(keyOf(i), count);
+        answerQueries(directory, sent);
+        if (directory.cacheSize() > capacity) {
+            print::error("the cache grew past its capacity to " + std::to_string(directory.cacheSize()));
+            passed = false;
+            break;
+        }
+    }
+    print::info(std::to_string(4 * capacity) + " answers, " + std::to_string(directory.cacheSize()) + " cached");
+
+    // the latest answers are in the cache, the first ones were dropped
+    size_t queries = directory.parentQueries;
+    for (size_t i = 3 * capacity; i < 4 * capacity; i++) directory.lookup(keyOf(i), count);
+    if (directory.parentQueries != queries || !sent.empty()) {
+        print::error("the latest answers are not all in the cache");
+        passed = false;
+    }
+    directory.lookup(keyOf(0), count);
+    if (sent.size() != 1) {
+        print::error("the oldest answer was not dropped from the cache");
+        passed = false;
+    }
+    answerQueries(directory, sent);
+    if (found != 5 * capacity + 1) {
+        print::error("lookups were not answered");
+        passed = false;
+    }
+
+    print::info(passed ? "passed" : "failed");
+    return passed ? 0 : 1;
+}
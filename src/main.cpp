@@ -3,68 +3,91 @@
 
 #define NODE_VERSION "axolotl_alpha"
 
+#include <fcntl.h>
+
 #include "cli/common.hpp"
 #include "networking/common.hpp"
 #include "cryptography/common.hpp"
 using namespace cli;
 
 // list of all packet types
-enum class pT {
+enum class pT : uint8_t {
     nodeValidation,
+    dhtFindNode,
+    dhtNodes,
+    dhtStore,
+    directoryQuery,
+    directoryAnswer,
+    directoryRegister,
     textMessage
 };
 
-// size in bytes for all packet types
-int pS[] = {
-    19,
-    256
-};
+// specs of all packet types, handlers are matched by these types
+typedef ValidationPacket<pT::nodeValidation> NodeValidation;
+typedef DHTFindNodePacket<pT::dhtFindNode> DHTFindNode;
+typedef DHTNodesPacket<pT::dhtNodes> DHTNodes;
+typedef DHTStorePacket<pT::dhtStore> DHTStore;
+typedef DirectoryQueryPacket<pT::directoryQuery> DirectoryQuery;
+typedef DirectoryAnswerPacket<pT::directoryAnswer> DirectoryAnswer;
+typedef DirectoryRegisterPacket<pT::directoryRegister> DirectoryRegister;
+struct TextMessage : VariablePacket<pT::textMessage, 0, 256> {};
+
+// packet registry of the protocol, specs are listed in the order of the packet types
+typedef PacketRegistry<pT, NodeValidation, DHTFindNode, DHTNodes, DHTStore, DirectoryQuery, DirectoryAnswer, DirectoryRegister, TextMessage> pR;
 
-class Node : public Endpoint<pT, pS> {
+class Node : public Endpoint<pR, Node> {
     public:
         using Endpoint::Endpoint;
 
         // event handler - incoming connection (return value false means dropping connection)
-        virtual bool onNodeConnect(std::shared_ptr<Connection<pT, pS>> _remoteNode) {
+        virtual bool onNodeConnect(std::shared_ptr<Connection<pR>> _remoteNode) {
             return true;
         }
 
         // event handler - disconnection of remote node
-        virtual void onNodeDisconnect(std::shared_ptr<Connection<pT, pS>> _remoteNode) {
+        virtual void onNodeDisconnect(std::shared_ptr<Connection<pR>> _remoteNode) {
 
         }
 
-        // event handler - incoming packet (handle incoming packets here)
-        virtual void onMessage(MetaPacket<pT, pS>& _packet) {
+        // event handler - incoming text message (add an overload for each handled packet type)
+        void onMessage(TextMessage, MetaPacket<pR>& _packet) {
             print::info("onMessage(): incoming packet");
-            // handler for each packet type
-            switch (_packet.content.header.packetType) {
-                case pT::textMessage: {
-                    char s[256];
-                    _packet.content >> s;
-                    print::notice(
-                        std::string(_packet.senderPublicKey) + 
-                        std::string(": ") + 
-                        std::string(s)
-                    );
-                    break;
-                }
-                // default case always means programming error
-                default: {
-                    print::error("onMessage() - error: this message should not have got to this handler");
-                    std::cout << _packet;
-                    break;
-                }
-            }
+            // text messages are sent without padding, the whole body is the text
+            std::string_view s = PacketReader<pR>(_packet.content).readText();
+            print::notice(
+                std::string(_packet.senderPublicKey) + 
+                std::string(": ") + 
+                std::string(s)
+            );
         }
+};
 
-        virtual void queryConnectionData(
-            char* _publicKey, 
-            std::function<void(ConnectionData<pT, pS>)> callback = [](ConnectionData<pT, pS>){}
-        ) {
-            
+// async - reads 'input' line by line until its end, 'onLine' gets each line without the line break
+awaitable<void> readLines(
+    posix::stream_descriptor input, 
+    std::function<void(std::string_view)> onLine
+) {
+    std::string buffer;
+    try {
+        while (true) {
+            size_t lineSize = co_await async_read_until(input, dynamic_buffer(buffer), '\n', use_awaitable);
+            onLine(std::string_view(buffer.data(), lineSize - 1));
+            buffer.erase(0, lineSize);
         }
-};
+    } catch (boost::system::system_error& e) {
+        if (e.code() != error::eof) print::error(std::string("readLines() - error: ") + e.what());
+    }
+    // the last line may end without a line break
+    if (!buffer.empty()) onLine(buffer);
+}
+
+// text message with the characters of 'text', the body is not padded
+Packet<pR> textMessage(std::string_view text) {
+    Packet<pR> p;
+    p.header.packetType = pT::textMessage;
+    PacketWriter<pR>(p).write(text.substr(0, 256));
+    return p;
+}
 
 int32_t main (
     int32_t argCount, 
@@ -78,32 +101,83 @@ int32_t main (
 
     print::setLogLevel(print::logLevels::trace);
 
-    // creating node instance
-    Node myNode = Node(PUBLIC_KEY, LOCAL_PORT);
+    // with a single io thread everything runs on this thread: the node, its handlers and the input
+    // with more, the node runs its own io threads and this thread only reads the input
+    io_context mainContext(1);
+
+    // creating node instance, incoming messages are handled right on the io thread that read them
+    std::unique_ptr<Node> myNode = IO_THREADS > 1
+        ? std::make_unique<Node>(PUBLIC_KEY, LOCAL_PORT, DEFAULT_MAX_FRAME_SIZE, IO_THREADS)
+        : std::make_unique<Node>(mainContext, PUBLIC_KEY, LOCAL_PORT);
+    myNode->dispatchMode = DispatchMode::ioThread;
+    myNode->pinIOThreads = PIN_IO_THREADS;
 
     // starting node instance
-    myNode.start();
+    myNode->start();
 
-    // this thread checks for new packets in an infinite loop
-    std::thread thr = std::thread([&](){
-        while (1) {
-            myNode.update(-1, true);
-        }
-    });
+    // peers of the previous run are connected right away
+    if (PEER_CACHE_PATH != "" && myNode->openPeerCache(PEER_CACHE_PATH)) {
+        myNode->reconnectKnownPeers();
+    }
 
-    if (REMOTE_IP != "" && REMOTE_PORT) {
-        myNode.connect(
+    if (SCRIPT_PATH != "") {
+        // scripted mode - the lines of the script are sent once the remote node is connected
+        int scriptFile = SCRIPT_PATH == "-" ? ::dup(STDIN_FILENO) : ::open(SCRIPT_PATH.c_str(), O_RDONLY);
+        if (scriptFile < 0 || REMOTE_IP == "" || !REMOTE_PORT) {
+            print::error("main() - error: the script needs a readable file and a remote node");
+            return 1;
+        }
+        myNode->connect(
             REMOTE_IP,
-            REMOTE_PORT
+            REMOTE_PORT,
+            [&mainContext, &myNode, scriptFile] (std::shared_ptr<Connection<pR>> conn) {
+                auto started = std::chrono::steady_clock::now();
+                auto sentCount = std::make_shared<size_t>(0);
+                co_spawn(
+                    mainContext,
+                    readLines(
+                        posix::stream_descriptor(mainContext, scriptFile),
+                        [&myNode, conn, sentCount] (std::string_view line) {
+                            myNode->sendNode(conn, textMessage(line));
+                            (*sentCount)++;
+                        }
+                    ),
+                    [started, sentCount] (std::exception_ptr) {
+                        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+                        print::notice(std::string("script: ") + std::to_string(*sentCount) + std::string(" messages sent in ")
+                            + std::to_string(seconds) + std::string(" s"));
+                    }
+                );
+            }
+        );
+    } else {
+        // the remote node is the entry point to the network, the others are found through the dht,
+        // or through the remote node itself if it is the parent of this node
+        if (REMOTE_IP != "" && REMOTE_PORT && REMOTE_IS_PARENT) {
+            myNode->connectParent(
+                REMOTE_IP,
+                REMOTE_PORT
+            );
+        } else if (REMOTE_IP != "" && REMOTE_PORT) {
+            myNode->joinNetwork(
+                REMOTE_IP,
+                REMOTE_PORT
+            );
+        }
+        // interactive mode - each line of the standard input is sent as a message
+        co_spawn(
+            mainContext,
+            readLines(
+                posix::stream_descriptor(mainContext, ::dup(STDIN_FILENO)),
+                [&myNode] (std::string_view line) {
+                    myNode->sendNode(REMOTE_PUBLIC_KEY, textMessage(line));
+                }
+            ),
+            detached
         );
     }
 
-    while (1) {
-        Packet<pT, pS> p;
-        p.header.packetType = pT::textMessage;
-        char s[256];
-        std::cin.getline(s, 256);
-        p << s;
-        myNode.sendNode(REMOTE_PUBLIC_KEY, p);
-    }
-}
\ No newline at end of file
+    // keeps running after the input ended, until the process is stopped
+    auto work = make_work_guard(mainContext);
+    mainContext.run();
+}
@@ -0,0 +1,74 @@
+// Copyright (c) 2022 Dániel Gergely, Dénes Balogh
+// Distributed under the MIT License.
+
+#pragma once
+#include "common.hpp"
+
+// thread-safely recycles packet body buffers sorted into a few size classes,
+// once warmed up the receive path does not need to touch the heap
+class BufferPool {
+    private:
+        static constexpr std::array<size_t, 6> classSizes = { 64, 256, 1024, 4096, 16384, 65536 };
+        // bytes kept per size class, the rest is given back to the heap
+        // small buffers are cached in large numbers, as every packet under way holds one
+        static constexpr size_t maxCachedBytes = 1 << 22;
+
+        std::mutex containerMutex;
+        std::array<std::vector<std::vector<uint8_t>>, classSizes.size()> freeBuffers;
+        // number of buffers the pool had to allocate from the heap
+        std::atomic<uint64_t> allocationCount = 0;
+        // number of buffers served from the free lists
+        std::atomic<uint64_t> reuseCount = 0;
+
+    public:
+        BufferPool() = default;
+        BufferPool(const BufferPool&) = delete;
+        virtual ~BufferPool() { clear(); }
+
+        // returns an empty buffer with a capacity of at least 'size' bytes
+        std::vector<uint8_t> acquire(size_t size) {
+            std::vector<uint8_t> buffer;
+            if (size == 0) return buffer;
+            size_t sizeClass = 0;
+            while (sizeClass < classSizes.size() && classSizes[sizeClass] < size) sizeClass++;
+            if (sizeClass < classSizes.size()) {
+                std::scoped_lock lock(containerMutex);
+                if (!freeBuffers[sizeClass].empty()) {
+                    buffer = std::move(freeBuffers[sizeClass].back());
+                    freeBuffers[sizeClass].pop_back();
+                    reuseCount++;
+                    return buffer;
+                }
+            }
+            // oversized buffers are never cached, they always come from the heap
+            buffer.reserve(sizeClass < classSizes.size() ? classSizes[sizeClass] : size);
+            allocationCount++;
+            return buffer;
+        }
+
+        // takes back ownership of a buffer, the largest class it can serve decides where it goes
+        // buffers larger than every class go back to the heap, so one large packet does not stay cached
+        void release(std::vector<uint8_t>&& buffer) {
+            if (buffer.capacity() < classSizes[0] || buffer.capacity() > classSizes.back()) return;
+            size_t sizeClass = classSizes.size() - 1;
+            while (classSizes[sizeClass] > buffer.capacity()) sizeClass--;
+            buffer.clear();
+            std::scoped_lock lock(containerMutex);
+            if (freeBuffers[sizeClass].size() < maxCachedBytes / classSizes[sizeClass]) {
+                freeBuffers[sizeClass].push_back(std::move(buffer));
+            }
+        }
+
+        void clear() {
+            std::scoped_lock lock(containerMutex);
+            for (auto& buffers : freeBuffers) buffers.clear();
+        }
+
+        uint64_t allocations() const {
+            return allocationCount;
+        }
+
+        uint64_t reuses() const {
+            return reuseCount;
+        }
+};
@@ -18,9 +18,15 @@
 #include <algorithm>
 #include <fstream>
 #include <mutex>
+#include <condition_variable>
+#include <atomic>
 #include <map>
 #include <array>
 #include <unordered_map>
+#include <span>
+#include <string_view>
+#include <optional>
+#include <random>
 
 //#define BOOST_ASIO_ENABLE_HANDLER_TRACKING
 
@@ -29,8 +35,15 @@
 #endif
 
 #include <boost/asio.hpp>
+#include <boost/asio/experimental/concurrent_channel.hpp>
 #include <boost/system/error_code.hpp>
 #include <boost/algorithm/string.hpp>
+#include <boost/endian/conversion.hpp>
+#include <boost/endian/arithmetic.hpp>
+
+#include <cryptopp/filters.h>
+#include <cryptopp/zdeflate.h>
+#include <cryptopp/zinflate.h>
 
 using namespace boost::asio;
 using namespace cli;
@@ -41,8 +54,67 @@ typedef std::string ipAddress;
 typedef uint16_t port;
 typedef char* publicKey;
 
+// frames with a larger body are refused by default in both directions
+const uint32_t DEFAULT_MAX_FRAME_SIZE = 1 << 20;
+// handshake bodies may be this long, so later versions can append fields to them
+const size_t MAX_VALIDATION_BODY_SIZE = 1 << 10;
+// queued outgoing packets are written in batches of up to this many bytes
+const size_t DEFAULT_WRITE_BUDGET = 1 << 16;
+// initial size of the receive buffer of a connection, it only grows for frames larger than this
+const size_t DEFAULT_READ_BUFFER_SIZE = 1 << 16;
+// bodies smaller than this are never compressed
+const size_t DEFAULT_COMPRESSION_THRESHOLD = 256;
+// larger bodies are written in fragments of this size, so they do not hold back the other lanes
+const size_t DEFAULT_FRAGMENT_SIZE = 1 << 14;
+// a connection stops reading once it has this many packets waiting for processing,
+// and starts again when it gets down to the low watermark
+const size_t DEFAULT_CONNECTION_HIGH_WATERMARK = 1 << 12;
+const size_t DEFAULT_CONNECTION_LOW_WATERMARK = 1 << 10;
+// the same for the whole incoming queue of an endpoint, which keeps it bounded while the node is slower than its peers
+const size_t DEFAULT_QUEUE_HIGH_WATERMARK = 3 << 12;
+const size_t DEFAULT_QUEUE_LOW_WATERMARK = 1 << 12;
+// number of strands the senders are sharded over when dispatching by the hash of their public key
+const size_t DEFAULT_DISPATCH_SHARDS = 64;
+// contacts kept in each k-bucket of the dht, and returned by a node for a lookup
+const size_t DHT_BUCKET_SIZE = 8;
+// nodes queried at the same time by a lookup of the dht
+const size_t DHT_PARALLELISM = 3;
+// a lookup of the dht that has not finished by then fails
+const std::chrono::milliseconds DHT_LOOKUP_TIMEOUT = std::chrono::milliseconds(3000);
+// answers of the parent node are cached this long, found and missing nodes separately
+const std::chrono::milliseconds DEFAULT_DIRECTORY_POSITIVE_TTL = std::chrono::milliseconds(60000);
+const std::chrono::milliseconds DEFAULT_DIRECTORY_NEGATIVE_TTL = std::chrono::milliseconds(5000);
+// a lookup through the parent node that has not been answered by then fails
+const std::chrono::milliseconds DIRECTORY_LOOKUP_TIMEOUT = std::chrono::milliseconds(2000);
+// expired answers are dropped from the cache once it holds this many
+const size_t DIRECTORY_CACHE_SIZE = 1 << 16;
+// record slots of a new peer cache file, it doubles when it gets 3/4 full
+const size_t DEFAULT_PEER_CACHE_CAPACITY = 1 << 10;
+// known peers connected again when a node starts with a peer cache
+const size_t DEFAULT_RECONNECT_PEERS = 8;
+// connections without reads or writes for this long are closed, they are opened again when needed
+const std::chrono::milliseconds DEFAULT_IDLE_TIMEOUT = std::chrono::milliseconds(300000);
+// open connections of an endpoint above this are closed, the least recently active first
+const size_t DEFAULT_MAX_CONNECTIONS = 1 << 10;
+// connections are checked for idleness this often
+const std::chrono::milliseconds DEFAULT_SWEEP_INTERVAL = std::chrono::milliseconds(5000);
+// packets sent to a node while it is being connected, the ones above this are dropped
+const size_t DEFAULT_MAX_PENDING_PACKETS = 1 << 10;
+
+#include "completion.hpp"
+#include "compression.hpp"
+#include "registry.hpp"
 #include "packet.hpp"
 #include "queue.hpp"
+#include "bufferPool.hpp"
+#include "handlerMemory.hpp"
+#include "ringBuffer.hpp"
+#include "ioContextPool.hpp"
 #include "routingTable.hpp"
+#include "lifetime.hpp"
+#include "dht.hpp"
+#include "directory.hpp"
+#include "peerCache.hpp"
 #include "connection.hpp"
+#include "connectionManager.hpp"
 #include "endpoint.hpp"
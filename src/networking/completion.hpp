@@ -0,0 +1,24 @@
+// Copyright (c) 2022 Dániel Gergely, Dénes Balogh
+// Distributed under the MIT License.
+
+#pragma once
+#include "common.hpp"
+
+// the initiating functions of the node ('asyncConnect', 'asyncSend', 'asyncReceive') take asio completion tokens,
+// so they can be awaited with 'use_awaitable', or called with a plain handler
+
+// completes an operation the way asio's own operations do, on the executor associated with the handler
+// 'fallback' is used for handlers without one, it should be the executor of the object doing the work
+template <typename handlerT, typename... argTs> void completeOn(
+    const any_io_executor& fallback,
+    handlerT&& handler,
+    argTs&&... args
+) {
+    auto executor = get_associated_executor(handler, fallback);
+    post(
+        executor,
+        [handler = std::forward<handlerT>(handler), ...args = std::forward<argTs>(args)] () mutable {
+            std::move(handler)(std::move(args)...);
+        }
+    );
+}
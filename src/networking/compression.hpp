@@ -0,0 +1,85 @@
+// Copyright (c) 2022 Dániel Gergely, Dénes Balogh
+// Distributed under the MIT License.
+
+#pragma once
+#include "common.hpp"
+
+// statistics of the packet compression of a connection
+struct CompressionStats {
+    // packets sent compressed and packets where compression did not pay off
+    std::atomic<uint64_t> compressedPackets = 0;
+    std::atomic<uint64_t> skippedPackets = 0;
+    // body sizes of the compressed packets before and after compression
+    std::atomic<uint64_t> originalBytes = 0;
+    std::atomic<uint64_t> compressedBytes = 0;
+    std::atomic<uint64_t> inflatedPackets = 0;
+    // time spent compressing and inflating, in nanoseconds
+    std::atomic<uint64_t> compressionTime = 0;
+    std::atomic<uint64_t> inflationTime = 0;
+
+    // compressed size relative to the original size
+    double ratio() const {
+        return originalBytes ? double(compressedBytes) / double(originalBytes) : 1.0;
+    }
+};
+
+// compressed bodies are raw deflate streams prefixed with the original body size (u32, big-endian)
+namespace Compression {
+    const size_t PrefixSize = sizeof(uint32_t);
+
+    // returns false and leaves 'output' empty if the compressed body would not be smaller
+    bool Deflate(
+        std::span<const uint8_t> _input,
+        std::vector<uint8_t>& _output
+    ) {
+        _output.clear();
+        _output.reserve(_input.size());
+        uint32_t originalSize = boost::endian::native_to_big(uint32_t(_input.size()));
+        _output.resize(PrefixSize);
+        std::memcpy(_output.data(), &originalSize, PrefixSize);
+        try {
+            // the fastest level, compression runs on the sending thread
+            CryptoPP::Deflator deflator(new CryptoPP::VectorSink(_output), 1);
+            deflator.Put(_input.data(), _input.size());
+            deflator.MessageEnd();
+        } catch (CryptoPP::Exception& e) {
+            print::error(std::string("Compression::Deflate() - error: ") + e.what());
+            _output.clear();
+            return false;
+        }
+        if (_output.size() >= _input.size()) {
+            _output.clear();
+            return false;
+        }
+        return true;
+    }
+
+    // size the body had before compression, 0 if the prefix is missing
+    size_t OriginalSize(
+        std::span<const uint8_t> _input
+    ) {
+        if (_input.size() < PrefixSize) return 0;
+        uint32_t originalSize;
+        std::memcpy(&originalSize, _input.data(), PrefixSize);
+        return boost::endian::big_to_native(originalSize);
+    }
+
+    // inflates into 'output', which has to be resized to the original size beforehand
+    // fails if the stream is corrupted or does not match the announced size
+    bool Inflate(
+        std::span<const uint8_t> _input,
+        std::vector<uint8_t>& _output
+    ) {
+        try {
+            CryptoPP::ArraySink* sink = new CryptoPP::ArraySink(_output.data(), _output.size());
+            CryptoPP::Inflator inflator(sink);
+            inflator.Put(_input.data() + PrefixSize, _input.size() - PrefixSize);
+            inflator.MessageEnd();
+            // the sink stops writing at its capacity but keeps counting
+            return sink->TotalPutLength() == _output.size();
+        } catch (CryptoPP::Exception& e) {
+            print::error(std::string("Compression::Inflate() - error: ") + e.what());
+            return false;
+        }
+    }
+}
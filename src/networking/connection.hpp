@@ -4,29 +4,122 @@
 #pragma once
 #include "common.hpp"
 
-template <typename pT, int* pS> class Connection : public std::enable_shared_from_this<Connection<pT, pS>> {
+// reading stops when a packet count reaches 'high' and starts again once it is down to 'low'
+struct Watermarks {
+    size_t high;
+    size_t low;
+};
+
+template <typename pR> class Connection : public std::enable_shared_from_this<Connection<pR>> {
     public:
+        using pT = typename pR::type;
+
         // single instance is shared across the whole node
         io_context& connIOContext;
         ip::tcp::socket connSocket;
         // incoming queue does not need to be separated by sender
         // MetaPacket already has the metadata of the sender
-        Queue<MetaPacket<pT, pS>>& connPacketsIn;
-        // every connection has separated outgoing packet queue
-        Queue<Packet<pT, pS>> connPacketsOut;
-        // gets filled with the packet under arrival, which is then copied into its own packet instance
-        Packet<pT, pS> connPacketBuffer;
-        // will be the public key of the remote node for identification
-        char publicKey[5];
+        Queue<MetaPacket<pR>>& connPacketsIn;
+        // packet bodies are read into buffers of the endpoint's pool and handed over to the incoming queue
+        BufferPool& connBufferPool;
+        // every connection has separated outgoing packet queues, one for each lane
+        // they are only touched on the io thread, a packet stays in its lane until it is written completely
+        std::array<RingBuffer<Packet<pR>>, packetLanes::count> connPacketsOut;
+        // bytes of the first unfinished packet of each lane that are already taken as fragments
+        std::array<size_t, packetLanes::count> connLaneOffsets = {};
+        // bytes each lane may still write in the current round of the scheduler
+        std::array<size_t, packetLanes::count> connLaneDeficits = {};
+        // buffer sequence of the batch under writing, reused between batches
+        std::vector<const_buffer> connWriteBuffers;
+        // headers and bodies of the frames in the batch under writing, the headers are copies,
+        // so the lanes may grow (and move their packets) while the batch is written
+        std::vector<PacketHeader<pR>> connWriteHeaders;
+        std::vector<std::span<const uint8_t>> connWriteBodies;
+        // a batch is closed when adding the next frame would exceed this many bytes
+        size_t connWriteBudget = DEFAULT_WRITE_BUDGET;
+        // bodies larger than this are written in fragments
+        size_t connFragmentSize = DEFAULT_FRAGMENT_SIZE;
+        // fragmented bodies under reassembly, one for each lane of the remote node
+        std::array<Packet<pR>, packetLanes::count> connReassembly;
+        // gets filled with the packet under arrival, which is then moved into its own packet instance
+        Packet<pR> connPacketBuffer;
+        // bytes received from the socket, packets are parsed from the range [connReadStart, connReadEnd)
+        std::vector<uint8_t> connReadBuffer;
+        size_t connReadStart = 0;
+        size_t connReadEnd = 0;
+        // will be the public key of the remote node for identification, empty until the handshake
+        char publicKey[5] = {};
+        // port the remote node listens on, known after the handshake, zero if the remote node did not send it
+        uint16_t connRemotePort = 0;
+        // public key and listening port of the local node, sent in the handshake
+        char connLocalPublicKey[5] = {};
+        uint16_t connLocalPort = 0;
+        // time tcp took to connect, a round trip time sample, only measured for outgoing connections
+        std::chrono::microseconds connConnectRTT = std::chrono::microseconds(0);
+        // steady clock ticks of the last read or written data, idle connections are closed by it
+        std::atomic<std::chrono::steady_clock::rep> connLastActivity = std::chrono::steady_clock::now().time_since_epoch().count();
+        // frames with a larger body are refused in both directions
+        uint32_t connMaxFrameSize;
+        // largest body the remote node accepts, known after the handshake
+        std::atomic<uint32_t> connRemoteMaxFrameSize = DEFAULT_MAX_FRAME_SIZE;
+        // wire features offered by this node, and the ones both nodes support after the handshake
+        uint32_t connCapabilities;
+        std::atomic<uint32_t> connAgreedCapabilities = 0;
+        // bodies smaller than this are sent as they are
+        size_t connCompressionThreshold = DEFAULT_COMPRESSION_THRESHOLD;
+        CompressionStats connCompressionStats;
+        // packets of this connection in the incoming queue or under processing
+        std::atomic<size_t> connPendingPackets = 0;
+        // limits for the packets of this connection and for the whole incoming queue
+        Watermarks connWatermarks;
+        Watermarks connQueueWatermarks;
+        // set while no read is armed because the incoming queue is full,
+        // the remote node is then slowed down by tcp flow control
+        std::atomic<bool> connReadPaused = false;
+        // called once when the connection fails or is closed, set by the handshake and used by the reading and writing loops
+        // it is dropped after the call, so the callbacks it holds do not keep the connection or the endpoint alive
+        std::function<void(std::shared_ptr<Connection<pR>>)> connReject = [](std::shared_ptr<Connection<pR>>){};
+        std::atomic<bool> connFailed = false;
+        // set once the socket is connected and cleared when the connection fails or is closed,
+        // so other threads can check it while the io thread closes the socket
+        std::atomic<bool> connOpen = false;
+        // completion handlers of the hot paths are allocated from here, so a warmed up connection does not allocate
+        HandlerMemory connHandlerMemory;
+        // keeps the handlers of this connection's packets in order on the dispatch pool of the endpoint,
+        // created by the endpoint when it dispatches the first packet
+        std::optional<strand<thread_pool::executor_type>> connDispatchStrand;
+        // once asyncReceive() is called, the packets of this connection are delivered through this channel
+        // instead of the incoming queue of the endpoint, they count as pending until they are received
+        experimental::concurrent_channel<void(boost::system::error_code, MetaPacket<pR>)> connReceiveChannel;
+        std::atomic<bool> connReceiving = false;
+        // io thread only - set while a packet waits for room in the channel, nothing is parsed or read until it gets in,
+        // so the packets after it can not overtake it
+        bool connChannelBlocked = false;
+        // if set, packets are handed over to this on the io thread instead of the incoming queue,
+        // it has to finish with the packet (see Endpoint::finishPacket()) before returning
+        std::function<void(MetaPacket<pR>&)> connDeliver;
 
         Connection (
             io_context& _IOContext,
             ip::tcp::socket _socket,
-            Queue<MetaPacket<pT, pS>>& _packetsIn
+            Queue<MetaPacket<pR>>& _packetsIn,
+            BufferPool& _bufferPool,
+            uint32_t _maxFrameSize = DEFAULT_MAX_FRAME_SIZE,
+            uint32_t _capabilities = nodeCapabilities::all,
+            Watermarks _watermarks = { DEFAULT_CONNECTION_HIGH_WATERMARK, DEFAULT_CONNECTION_LOW_WATERMARK },
+            Watermarks _queueWatermarks = { DEFAULT_QUEUE_HIGH_WATERMARK, DEFAULT_QUEUE_LOW_WATERMARK }
         ) :
              connIOContext(_IOContext),
             connSocket(std::move(_socket)),
-            connPacketsIn(_packetsIn)  {}
+            connPacketsIn(_packetsIn),
+            connBufferPool(_bufferPool),
+            connReadBuffer(DEFAULT_READ_BUFFER_SIZE),
+            connMaxFrameSize(_maxFrameSize),
+            connCapabilities(_capabilities),
+            connWatermarks(_watermarks),
+            connQueueWatermarks(_queueWatermarks),
+            connOpen(connSocket.is_open()),
+            connReceiveChannel(_IOContext, _watermarks.high)  {}
 
         virtual ~Connection () {}
 
@@ -35,23 +128,28 @@ template <typename pT, int* pS> class Connection : public std::enable_shared_fro
         void remoteConnect (
             ip::tcp::resolver::results_type& endpoints, 
             char* localPublicKey, 
-            std::function<void(std::shared_ptr<Connection<pT, pS>>)> callback = [](std::shared_ptr<Connection<pT, pS>>){},
-            std::function<void(std::shared_ptr<Connection<pT, pS>>)> reject = [](std::shared_ptr<Connection<pT, pS>>){}
+            std::function<void(std::shared_ptr<Connection<pR>>)> callback = [](std::shared_ptr<Connection<pR>>){},
+            std::function<void(std::shared_ptr<Connection<pR>>)> reject = [](std::shared_ptr<Connection<pR>>){}
         ) {
             print::debug("remoteConnect(): connecting to remote node");
+            connReject = reject;
+            auto started = std::chrono::steady_clock::now();
             async_connect(
                 connSocket, 
                 endpoints, 
-                [this, callback, reject] (
+                [this, self = this->shared_from_this(), callback, started] (
                     std::error_code ec, 
                     ip::tcp::endpoint endpoint
                 ) {
+                    if (connFailed) return;
                     if (!ec) {
                         print::debug("remoteConnect(): connected to remote node");
-                        validateNode(callback, reject);
+                        connOpen = true;
+                        connConnectRTT = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - started);
+                        validateNode(callback);
                     } else {
                         print::error("remoteConnect() - error: " + ec.message());
-                        reject(this->shared_from_this());
+                        fail();
                     }
                 }
             );
@@ -59,46 +157,65 @@ template <typename pT, int* pS> class Connection : public std::enable_shared_fro
 
         // async - calls validation for incoming connection
         void localConnect (
-            std::function<void(std::shared_ptr<Connection<pT, pS>>)> callback = [](std::shared_ptr<Connection<pT, pS>>){},
-            std::function<void(std::shared_ptr<Connection<pT, pS>>)> reject = [](std::shared_ptr<Connection<pT, pS>>){}
+            std::function<void(std::shared_ptr<Connection<pR>>)> callback = [](std::shared_ptr<Connection<pR>>){},
+            std::function<void(std::shared_ptr<Connection<pR>>)> reject = [](std::shared_ptr<Connection<pR>>){}
         ) {
+            connReject = reject;
             if (connSocket.is_open()) {
-                validateNode(callback, reject);
+                validateNode(callback);
             }
         }
 
         // async - sends a validation packet and waits for one too from the remote node
-        // the validation packet also contains the public key of the remote node
+        // the validation packet also contains the public key of the remote node, connReject is called if it fails
         void validateNode (
-            std::function<void(std::shared_ptr<Connection<pT, pS>>)> callback = [](std::shared_ptr<Connection<pT, pS>>){},
-            std::function<void(std::shared_ptr<Connection<pT, pS>>)> reject = [](std::shared_ptr<Connection<pT, pS>>){}
+            std::function<void(std::shared_ptr<Connection<pR>>)> callback = [](std::shared_ptr<Connection<pR>>){}
         ) {
             // reading packet header
             async_read(
                 connSocket, 
-                buffer(&connPacketBuffer.header, sizeof(PacketHeader<pT, pS>)),
-                [this, callback, reject] (
+                buffer(&connPacketBuffer.header, sizeof(PacketHeader<pR>)),
+                [this, self = this->shared_from_this(), callback] (
                     std::error_code _ec, 
                     std::size_t length
                 ) mutable {
-                    if (!_ec && connPacketBuffer.header.packetType == pT::nodeValidation) {
+                    if (connFailed) return;
+                    if (!_ec && connPacketBuffer.header.packetType == pT::nodeValidation
+                        && isAcceptableFrame(connPacketBuffer.header)) {
                         print::trace("validateNode(): validation header type is correct");
                         connPacketBuffer.body.resize(connPacketBuffer.header.bodySize());
                         // reading packet body
                         async_read(
                             connSocket, 
                             buffer(connPacketBuffer.body.data(), connPacketBuffer.header.bodySize()),
-                            [this, callback, reject] (
+                            [this, self = this->shared_from_this(), callback] (
                                 std::error_code __ec, 
                                 size_t _length
                             ) mutable {
+                                if (connFailed) return;
                                 if (!__ec) {
-                                    char protocolVer[14];
-                                    connPacketBuffer >> protocolVer;
-                                    print::trace(std::string("validateNode(): matching protocol version ") + std::string(protocolVer));
-                                    if (!std::strcmp(protocolVer, NODE_VERSION)) {
-                                        connPacketBuffer >> publicKey;
+                                    PacketReader<pR> reader(connPacketBuffer);
+                                    reader >> publicKey;
+                                    publicKey[sizeof(publicKey) - 1] = '\0';
+                                    // the version is compared in place, including its terminating zero
+                                    std::string_view protocolVer = reader.readText(sizeof(NODE_VERSION));
+                                    std::string protocolName(protocolVer.begin(), std::find(protocolVer.begin(), protocolVer.end(), '\0'));
+                                    print::trace(std::string("validateNode(): matching protocol version ") + protocolName);
+                                    boost::endian::big_uint32_t remoteCapabilities = 0;
+                                    boost::endian::big_uint32_t remoteMaxFrameSize = 0;
+                                    boost::endian::big_uint16_t remotePort = 0;
+                                    reader >> remoteCapabilities >> remoteMaxFrameSize;
+                                    // older nodes do not send their port, fields appended by newer versions are left unread
+                                    if (reader.remaining() >= sizeof(remotePort)) reader >> remotePort;
+                                    if (reader.ok() && protocolVer == std::string_view(NODE_VERSION, sizeof(NODE_VERSION))) {
                                         print::trace(std::string("validateNode(): has publicKey \"") + std::string(publicKey) + std::string("\""));
+                                        // from now on each feature is used only if both nodes support it
+                                        connAgreedCapabilities = connCapabilities & remoteCapabilities;
+                                        connRemoteMaxFrameSize = remoteMaxFrameSize;
+                                        connRemotePort = remotePort;
+                                        limitUnsentBytes();
+                                        print::debug(std::string("validateNode(): agreed capabilities ") 
+                                            + std::bitset<8>(connAgreedCapabilities).to_string());
                                         /* connRoutingTable.insert(std::pair< char*, std::pair<std::string, uint16_t> >
                                             (publicKey, std::pair<std::string, uint16_t> (
                                                 connSocket.remote_endpoint().address().to_string(),
@@ -109,164 +226,607 @@ template <typename pT, int* pS> class Connection : public std::enable_shared_fro
                                         /* if packet type and protocol version is matching, 
                                             the connection is considered fully established, 
                                             and is being started to be listened on */
-                                        read(reject);
+                                        read();
                                         callback(this->shared_from_this());
                                         std::strcpy(REMOTE_PUBLIC_KEY, publicKey);
                                     } else {
                                         print::error(std::string("validateNode() - error: unsupported protocol version \"") 
-                                            + std::string(protocolVer) + std::string("\""));
-                                        reject(this->shared_from_this());
+                                            + protocolName + std::string("\""));
+                                        fail();
                                     }
                                 } else {
                                     print::error(std::string("validateNode() - error: ") + __ec.message());
-                                    reject(this->shared_from_this());
+                                    fail();
                                 }
                             });
                         } else {
                             if (_ec) print::error(std::string("validateNode() - error: ") + _ec.message());
                             print::error("validateNode() - error: remote node validation failed");
-                            reject(this->shared_from_this());
+                            fail();
                         }  
                     });
             // constructing and sending validation packet
-            Packet<pT, pS> p;
-            p.header.packetType = pT::nodeValidation;
-            p << PUBLIC_KEY;
-            p << NODE_VERSION;
-            send(p, [](std::shared_ptr<Connection<pT, pS>>){});
+            ValidationPayload payload;
+            std::memcpy(payload.publicKey, connLocalPublicKey, sizeof(payload.publicKey));
+            std::memcpy(payload.protocolVersion, NODE_VERSION, sizeof(payload.protocolVersion));
+            payload.capabilities = connCapabilities;
+            payload.maxFrameSize = connMaxFrameSize;
+            payload.port = connLocalPort;
+            send(Packet<pR>::template of<typename pR::template spec<pT::nodeValidation>>(payload));
+        }
+
+        // the lanes can only take over each other in the outgoing queues, not in the socket buffer of the kernel,
+        // so with multiplexing the kernel is kept from buffering more than a batch of unsent bytes
+        void limitUnsentBytes() {
+#ifdef TCP_NOTSENT_LOWAT
+            if (!hasCapability(nodeCapabilities::multiplexing)) return;
+            boost::system::error_code ec;
+            connSocket.set_option(detail::socket_option::integer<IPPROTO_TCP, TCP_NOTSENT_LOWAT>(int(connWriteBudget)), ec);
+            if (ec) print::debug(std::string("limitUnsentBytes(): ") + ec.message());
+#endif
+        }
+
+        // any thread
+        bool isOpen() const {
+            return connOpen;
+        }
+
+        std::chrono::steady_clock::time_point lastActivity() const {
+            return std::chrono::steady_clock::time_point(std::chrono::steady_clock::duration(connLastActivity.load(std::memory_order_relaxed)));
+        }
+
+        void markActive() {
+            connLastActivity.store(std::chrono::steady_clock::now().time_since_epoch().count(), std::memory_order_relaxed);
+        }
+
+        // whether both nodes support a wire feature
+        bool hasCapability(uint32_t capability) const {
+            return connAgreedCapabilities & capability;
         }
 
-        bool isOpen() {
-            return connSocket.is_open();
+        // largest body that can be sent on this connection
+        uint32_t maxSendFrameSize() const {
+            return std::min<uint32_t>(connMaxFrameSize, connRemoteMaxFrameSize);
         }
 
+        // checks the announced type and body size against the registry and the limit of the connection
+        bool isAcceptableFrame(const PacketHeader<pR>& header) {
+            if (header.bodySize() > connMaxFrameSize) return false;
+            if (header.hasFlag(packetFlags::compressed) && !hasCapability(nodeCapabilities::compression)) return false;
+            // bounds of fragmented bodies are checked once they are complete
+            if (header.hasFlag(packetFlags::fragment)) {
+                return hasCapability(nodeCapabilities::multiplexing) && pR::isKnown(header.packetType);
+            }
+            // bounds of compressed packets are checked against their original size once it is known
+            if (header.hasFlag(packetFlags::compressed)) {
+                return pR::isKnown(header.packetType) && header.bodySize() >= Compression::PrefixSize;
+            }
+            return header.isValid();
+        }
+
+        // replaces the body with its compressed form if it is large enough and compression pays off
+        // has to happen before anything else transforms the body
+        void compress(Packet<pR>& packet) {
+            if (!hasCapability(nodeCapabilities::compression) || packet.body.size() < connCompressionThreshold) return;
+            auto start = std::chrono::steady_clock::now();
+            std::vector<uint8_t> compressedBody;
+            bool paysOff = Compression::Deflate(packet.body, compressedBody);
+            connCompressionStats.compressionTime += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start).count();
+            if (!paysOff) {
+                connCompressionStats.skippedPackets++;
+                return;
+            }
+            connCompressionStats.compressedPackets++;
+            connCompressionStats.originalBytes += packet.body.size();
+            connCompressionStats.compressedBytes += compressedBody.size();
+            packet.body = std::move(compressedBody);
+            packet.header.setFlag(packetFlags::compressed);
+        }
+
+        // inflates a compressed body into a buffer of the pool
+        // returns false if the original size does not fit the packet type or the stream is corrupted
+        bool inflate(const PacketHeader<pR>& header, std::span<const uint8_t> compressedBody, std::vector<uint8_t>& body) {
+            auto start = std::chrono::steady_clock::now();
+            size_t originalSize = Compression::OriginalSize(compressedBody);
+            if (!pR::isValid(header.packetType, originalSize) || originalSize > connMaxFrameSize) return false;
+            body = connBufferPool.acquire(originalSize);
+            body.resize(originalSize);
+            if (!Compression::Inflate(compressedBody, body)) return false;
+            connCompressionStats.inflatedPackets++;
+            connCompressionStats.inflationTime += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start).count();
+            return true;
+        }
+
+        // async - closes the socket, the connection counts as failed from then on
         void disconnect() {
             if (isOpen()) { 
                 post(
                     connIOContext, 
-                    [this] () {
+                    [self = this->shared_from_this()] () {
                         print::info("disconnect(): closing connection");
-                        connSocket.close();
+                        boost::system::error_code ec;
+                        self->connSocket.close(ec);
+                        self->fail();
                     }
                 );
             }
         }
 
+        // calls connReject once, then drops the callbacks set by the endpoint, 
+        // the connection is freed once the packets and handlers holding it are gone
+        void fail() {
+            if (connFailed.exchange(true)) return;
+            connOpen = false;
+            stopDelivery();
+            std::function<void(std::shared_ptr<Connection<pR>>)> reject = std::move(connReject);
+            connReject = nullptr;
+            if (reject) reject(this->shared_from_this());
+        }
+
+        // closes the socket right away without calling connReject, used by an endpoint that is stopping
+        // has to be called on the io thread or once it stopped, the handlers still queued then find the connection failed
+        // and return without touching the queue or the buffer pool of the endpoint
+        void close() {
+            connFailed = true;
+            connOpen = false;
+            stopDelivery();
+            connReject = nullptr;
+            connDispatchStrand.reset();
+            boost::system::error_code ec;
+            connSocket.close(ec);
+        }
+
+        // no more packets are handed over, the ones still buffered for asyncReceive() hold the connection, so they are dropped
+        void stopDelivery() {
+            while (connReceiveChannel.try_receive([] (boost::system::error_code, MetaPacket<pR>) {})) {}
+            connReceiveChannel.close();
+            connDeliver = nullptr;
+        }
+
         // async - send packet to remote node
         // pushes packet to outgoing queue and if processing is stopped starts it
-        void send(
-            const Packet<pT, pS>& _packet,
-            std::function<void(std::shared_ptr<Connection<pT, pS>>)> reject = [](std::shared_ptr<Connection<pT, pS>>){}
-        ) {
+        void send(const Packet<pR>& _packet) {
+            send(Packet<pR>(_packet));
+        }
+
+        // same as above without copying the packet, the body is given to the buffer pool once it is written,
+        // so bodies taken from the pool of the endpoint are recycled
+        void send(Packet<pR>&& packet) {
             print::trace("send(): sending packets");
+            if (!prepareToSend(packet)) return;
             post(
                 connIOContext, 
-                [this, _packet, reject] () {
-                    bool writingPacket = !connPacketsOut.empty();
-                    connPacketsOut.push_back(_packet);
-                    if (!writingPacket) writeFromQueue(reject);
-                }
+                withMemory(connHandlerMemory, [this, self = this->shared_from_this(), packet = std::move(packet)] () mutable {
+                    if (connFailed) return;
+                    enqueue(std::move(packet));
+                })
             );
         }
 
-        // async - processes outgoing packet queue
-        // serially writes all packets to socket
-        void writeFromQueue(
-            std::function<void(std::shared_ptr<Connection<pT, pS>>)> reject = [](std::shared_ptr<Connection<pT, pS>>){}
-        ) {
-            // writes header of the first packet in the queue
-            async_write(connSocket, buffer(&connPacketsOut.front().header, sizeof(PacketHeader<pT, pS>)),
-                [this, reject](std::error_code ec, std::size_t length) {
-                    if (!ec) {
-                        print::trace("writeFromQueue(): header wrote successfully");
-                        // write body only if packet has one
-                        if (connPacketsOut.front().header.bodySize() > 0) {
-                            print::trace(std::string("writeFromQueue(): packet has body (")
-                                + std::to_string(connPacketsOut.front().header.bodySize()) + std::string(" bytes)"));
-                            // writes body of the first packet in the queue
-                            async_write(
-                                connSocket, 
-                                buffer(connPacketsOut.front().body.data(), 
-                                connPacketsOut.front().header.bodySize()),
-                                [this, reject] (std::error_code _ec, std::size_t _length) {
-                                    if (_ec) {
-                                        print::error(std::string("writeFromQueue() - error: ") + _ec.message());
-                                        reject(this->shared_from_this());
-                                    }
-                                    else print::trace("writeFromQueue(): body wrote successfully");
-                                    // removes the sent packet from the queue
-                                    connPacketsOut.pop_front();
-                                    // recursively calls this function
-                                    if (!connPacketsOut.empty()) writeFromQueue();
-                                }
-                            );
-                        } else {
-                            // removes the sent packet from the queue
-                            connPacketsOut.pop_front();
-                            // recursively calls this function
-                            if (!connPacketsOut.empty()) writeFromQueue();
+        // io thread only - same as send(), but the packet is in its lane when this returns,
+        // packets posted from a handler only reach the queue of the context once the handler returns,
+        // so this keeps them ahead of the ones other threads send in the meantime
+        void sendFromIOThread(Packet<pR>&& packet) {
+            if (!prepareToSend(packet) || connFailed) return;
+            enqueue(std::move(packet));
+        }
+
+        // async - same as send(), completes with the error code once the packet is in its outgoing lane
+        // fails with 'message_size' if the body is too large and with 'not_connected' if the socket is closed
+        template <typename tokenT = use_awaitable_t<>> auto asyncSend(Packet<pR> packet, tokenT&& token = {}) {
+            return async_initiate<tokenT, void(boost::system::error_code)>(
+                [this] (auto handler, Packet<pR> packet) {
+                    if (!prepareToSend(packet)) {
+                        completeOn(connIOContext.get_executor(), std::move(handler), make_error_code(error::message_size));
+                        return;
+                    }
+                    post(
+                        connIOContext,
+                        [self = this->shared_from_this(), packet = std::move(packet), handler = std::move(handler)] () mutable {
+                            if (self->connFailed || !self->isOpen()) {
+                                completeOn(self->connIOContext.get_executor(), std::move(handler), make_error_code(error::not_connected));
+                                return;
+                            }
+                            self->enqueue(std::move(packet));
+                            completeOn(self->connIOContext.get_executor(), std::move(handler), boost::system::error_code());
                         }
-                    } else {
+                    );
+                },
+                token,
+                std::move(packet)
+            );
+        }
+
+        // async - completes with the next packet of this connection
+        // from the first call on, the packets of this connection bypass the incoming queue of the endpoint,
+        // fails with 'channel_closed' once the connection is lost
+        template <typename tokenT = use_awaitable_t<>> auto asyncReceive(tokenT&& token = {}) {
+            return async_initiate<tokenT, void(boost::system::error_code, MetaPacket<pR>)>(
+                [this] (auto handler) {
+                    connReceiving = true;
+                    connReceiveChannel.async_receive(
+                        [self = this->shared_from_this(), handler = std::move(handler)] (
+                            boost::system::error_code ec, 
+                            MetaPacket<pR> packet
+                        ) mutable {
+                            // the receiver owns the packet from now on
+                            if (!ec) self->packetProcessed();
+                            completeOn(self->connIOContext.get_executor(), std::move(handler), ec, std::move(packet));
+                        }
+                    );
+                },
+                token
+            );
+        }
+
+        // checks the size limit and compresses the body, on the sending thread
+        bool prepareToSend(Packet<pR>& packet) {
+            if (packet.body.size() > maxSendFrameSize()) {
+                print::error(std::string("send() - error: packet body exceeds the maximum frame size (")
+                    + std::to_string(packet.body.size()) + std::string(" bytes)"));
+                return false;
+            }
+            compress(packet);
+            return true;
+        }
+
+        // io thread only - puts a packet into its lane and starts writing if the connection is idle
+        void enqueue(Packet<pR>&& packet) {
+            // only the bytes present in the body are put on the wire
+            packet.header.setBodySize(packet.body.size());
+            bool writingPacket = hasOutgoingPackets();
+            connPacketsOut[pR::laneOf(packet.header.packetType)].push_back(std::move(packet));
+            if (!writingPacket) writeFromQueue();
+        }
+
+        // io thread only - a batch is being written while any lane has packets
+        bool hasOutgoingPackets() const {
+            for (const RingBuffer<Packet<pR>>& lane : connPacketsOut) {
+                if (!lane.empty()) return true;
+            }
+            return false;
+        }
+
+        // async - processes outgoing packet queues
+        // gathers frames of the lanes into one buffer sequence and writes them with a single call
+        // control packets go first, the other lanes share the budget of the batch by their weights
+        void writeFromQueue() {
+            connWriteBuffers.clear();
+            connWriteHeaders.clear();
+            connWriteBodies.clear();
+            // index of the next packet to take from each lane
+            std::array<size_t, packetLanes::count> cursors = {};
+            size_t batchSize = 0;
+            size_t frameCount = 0;
+            // without batching every frame is written on its own
+            size_t writeBudget = hasCapability(nodeCapabilities::batching) ? connWriteBudget : 0;
+            bool fragmenting = hasCapability(nodeCapabilities::multiplexing);
+            // the first frame is always taken, even if it is larger than the budget
+            auto fits = [&] (size_t lane) {
+                return cursors[lane] < connPacketsOut[lane].size() 
+                    && (frameCount == 0 || batchSize + nextFrameSize(lane, cursors[lane], fragmenting) <= writeBudget);
+            };
+            auto take = [&] (size_t lane) {
+                batchSize += scheduleFrame(lane, cursors[lane], fragmenting);
+                frameCount++;
+            };
+            while (fits(packetLanes::control)) take(packetLanes::control);
+            // deficit round robin, unused shares of a lane are carried over until the lane gets empty
+            // a lane only earns its share in the rounds it can be served, one blocked by the budget
+            // does not pile up a deficit that would let it flood the next batches
+            auto anyFits = [&] () {
+                for (size_t lane = packetLanes::control + 1; lane < packetLanes::count; lane++) {
+                    if (fits(lane)) return true;
+                }
+                return false;
+            };
+            while (anyFits()) {
+                for (size_t lane = packetLanes::control + 1; lane < packetLanes::count; lane++) {
+                    if (!fits(lane)) continue;
+                    connLaneDeficits[lane] += packetLanes::weights[lane] * connFragmentSize;
+                    while (fits(lane)) {
+                        size_t frameSize = nextFrameSize(lane, cursors[lane], fragmenting);
+                        if (frameSize > connLaneDeficits[lane]) break;
+                        connLaneDeficits[lane] -= frameSize;
+                        take(lane);
+                    }
+                }
+            }
+            for (size_t lane = packetLanes::control + 1; lane < packetLanes::count; lane++) {
+                if (cursors[lane] >= connPacketsOut[lane].size()) connLaneDeficits[lane] = 0;
+            }
+            for (size_t i = 0; i < connWriteHeaders.size(); i++) {
+                connWriteBuffers.push_back(buffer(&connWriteHeaders[i], sizeof(PacketHeader<pR>)));
+                if (!connWriteBodies[i].empty()) connWriteBuffers.push_back(buffer(connWriteBodies[i].data(), connWriteBodies[i].size()));
+            }
+            if (print::isEnabled(print::logLevels::trace)) {
+                print::trace(std::string("writeFromQueue(): writing ") + std::to_string(frameCount) 
+                    + std::string(" frames (") + std::to_string(batchSize) + std::string(" bytes)"));
+            }
+            // a view is passed, so asio does not copy the buffer sequence
+            async_write(
+                connSocket, 
+                std::span<const const_buffer>(connWriteBuffers),
+                withMemory(connHandlerMemory, [this, self = this->shared_from_this(), cursors] (std::error_code ec, std::size_t length) {
+                    if (connFailed) return;
+                    if (ec) {
                         print::error(std::string("writeFromQueue() - error: ") + ec.message());
-                        reject(this->shared_from_this());
+                        fail();
+                        return;
+                    }
+                    print::trace("writeFromQueue(): batch wrote successfully");
+                    markActive();
+                    // removes the completely sent packets from the lanes, their bodies go back to the pool
+                    for (size_t lane = 0; lane < packetLanes::count; lane++) {
+                        for (size_t i = 0; i < cursors[lane]; i++) {
+                            connBufferPool.release(std::move(connPacketsOut[lane][i].body));
+                        }
+                        connPacketsOut[lane].pop_front(cursors[lane]);
                     }
-                });
+                    // recursively calls this function
+                    if (hasOutgoingPackets()) writeFromQueue();
+                })
+            );
+        }
+
+        // size of the next frame of a lane on the wire, the whole packet or its next fragment
+        // the packet at the cursor may be partly taken already, by earlier batches or by this one
+        size_t nextFrameSize(size_t lane, size_t cursor, bool fragmenting) {
+            size_t remaining = connPacketsOut[lane][cursor].body.size() - connLaneOffsets[lane];
+            return sizeof(PacketHeader<pR>) + (fragmenting ? std::min(remaining, connFragmentSize) : remaining);
+        }
+
+        // adds the next frame of a lane to the batch and returns its size
+        // the cursor of the lane moves past the packet once its last byte is taken
+        size_t scheduleFrame(size_t lane, size_t& cursor, bool fragmenting) {
+            Packet<pR>& packet = connPacketsOut[lane][cursor];
+            // only the packet at the cursor of a lane may be partly taken, the offset belongs to it
+            size_t& offset = connLaneOffsets[lane];
+            size_t remaining = packet.body.size() - offset;
+            if (!fragmenting || (offset == 0 && remaining <= connFragmentSize)) {
+                connWriteHeaders.push_back(packet.header);
+                connWriteBodies.push_back(packet.body);
+                cursor++;
+                return sizeof(PacketHeader<pR>) + packet.body.size();
+            }
+            size_t partSize = std::min(remaining, connFragmentSize);
+            PacketHeader<pR>& header = connWriteHeaders.emplace_back(packet.header);
+            header.setBodySize(partSize);
+            header.setFlag(packetFlags::fragment);
+            header.setFlag(packetFlags::finalFragment, partSize == remaining);
+            connWriteBodies.push_back(std::span<const uint8_t>(packet.body.data() + offset, partSize));
+            offset += partSize;
+            if (offset == packet.body.size()) {
+                offset = 0;
+                cursor++;
+            }
+            return sizeof(PacketHeader<pR>) + partSize;
         }
 
         // async - reads incoming messages
-        // waits for a valid packet to be wrote on the socket and then pushes it to the incoming queue
-        // basically completes the writeFromQueue() method on the remote side
-        void read(std::function<void(std::shared_ptr<Connection<pT, pS>>)> reject = [](std::shared_ptr<Connection<pT, pS>>){}) {
-            async_read(
-                connSocket, 
+        // fills the receive buffer with whatever is available on the socket, then parses every complete packet
+        // from it before reading again, basically completes the writeFromQueue() method on the remote side
+        void read() {
+            prepareReadBuffer();
+            connSocket.async_read_some(
                 buffer(
-                    &connPacketBuffer.header, 
-                    sizeof(PacketHeader<pT, pS>)
+                    connReadBuffer.data() + connReadEnd, 
+                    connReadBuffer.size() - connReadEnd
                 ),
-                [this, reject] (std::error_code ec, std::size_t length) {
-                    if (!ec) {
-                        print::trace("read(): header read successfully");
-                        if (connPacketBuffer.header.bodySize() > 0) {
-                            print::trace(std::string("read(): packet has body (") + 
-                                std::to_string(connPacketBuffer.header.bodySize()) + std::string(" bytes)"));
-                            connPacketBuffer.body.resize(connPacketBuffer.header.bodySize());
-                            async_read(
-                                connSocket, 
-                                buffer(
-                                    connPacketBuffer.body.data(), 
-                                    connPacketBuffer.header.bodySize()
-                                ),
-                                [this, reject] (std::error_code _ec, size_t _length) {
-                                    if (!_ec) {
-                                        print::trace("read(): body read successfully");
-                                        // pushes the complete packet to the incoming queue
-                                        addToIncomingPacketQueue();
-                                        read();
-                                    } else {
-                                        print::error(std::string("read() - error: ") + _ec.message());
-                                        reject(this->shared_from_this());
-                                    }
-                                });
-                        } else {
-                            // pushes the complete packet to the incoming queue
-                            addToIncomingPacketQueue();
-                            read();
-                        }
-                    } else {
+                withMemory(connHandlerMemory, [this, self = this->shared_from_this()] (std::error_code ec, std::size_t length) {
+                    if (connFailed) return;
+                    if (ec) {
                         print::error(std::string("read() - error: ") + ec.message());
-                        reject(this->shared_from_this());
+                        fail();
+                        return;
+                    }
+                    if (print::isEnabled(print::logLevels::trace)) {
+                        print::trace(std::string("read(): received ") + std::to_string(length) + std::string(" bytes"));
                     }
+                    connReadEnd += length;
+                    markActive();
+                    processReadBuffer();
+                })
+            );
+        }
+
+        // parses the received packets, then reads again unless the incoming queue is full
+        void processReadBuffer() {
+            if (!parseFrames()) {
+                fail();
+                return;
+            }
+            // reading goes on once the channel took the blocked packet
+            if (connChannelBlocked) return;
+            if (isBackpressured()) {
+                pauseReading();
+                return;
+            }
+            read();
+        }
+
+        // whether the packets waiting for processing reached a high watermark
+        // the queue watermark only holds back connections that have packets in the queue themselves
+        bool isBackpressured() {
+            size_t pending = connPendingPackets;
+            return pending >= connWatermarks.high 
+                || (pending > 0 && connPacketsIn.count() >= connQueueWatermarks.high);
+        }
+
+        // whether a paused connection may read again
+        // a connection without pending packets is always resumed, nothing else would wake it up
+        bool canResume(size_t pending) {
+            return pending == 0 
+                || (pending <= connWatermarks.low && connPacketsIn.count() <= connQueueWatermarks.low);
+        }
+
+        // leaves the socket without an armed read until the consumer catches up
+        void pauseReading() {
+            print::debug("read(): incoming queue is full, reading paused");
+            connReadPaused = true;
+            // the consumer may have caught up before the flag was set
+            if (canResume(connPendingPackets)) resumeReading();
+        }
+
+        // any thread - restarts a paused reading loop, the buffered packets are parsed first
+        void resumeReading() {
+            if (!connReadPaused.exchange(false)) return;
+            post(
+                connIOContext,
+                [self = this->shared_from_this()] () {
+                    if (self->connFailed) return;
+                    print::debug("read(): reading resumed");
+                    self->processReadBuffer();
                 }
             );
         }
 
+        // consumer - called once the endpoint is done with a packet of this connection
+        void packetProcessed() {
+            size_t pending = --connPendingPackets;
+            if (connReadPaused && canResume(pending)) resumeReading();
+        }
+
+        // pushes the complete packets of the receive buffer to the incoming queue until it gets full
+        // returns false if the stream contains an invalid frame
+        bool parseFrames() {
+            while (connReadEnd - connReadStart >= sizeof(PacketHeader<pR>) && !isBackpressured() && !connChannelBlocked) {
+                PacketHeader<pR> header;
+                std::memcpy(&header, connReadBuffer.data() + connReadStart, sizeof(PacketHeader<pR>));
+                if (!isAcceptableFrame(header)) {
+                    print::error(std::string("read() - error: invalid frame (type ") + std::to_string(int(header.packetType)) 
+                        + std::string(", ") + std::to_string(header.bodySize()) + std::string(" bytes)"));
+                    return false;
+                }
+                size_t frameSize = sizeof(PacketHeader<pR>) + header.bodySize();
+                // the rest of the frame has not arrived yet
+                if (connReadEnd - connReadStart < frameSize) break;
+                std::span<const uint8_t> body(connReadBuffer.data() + connReadStart + sizeof(PacketHeader<pR>), header.bodySize());
+                connReadStart += frameSize;
+                bool accepted = header.hasFlag(packetFlags::fragment) ? reassemble(header, body) : addFrame(header, body);
+                if (!accepted) return false;
+            }
+            return true;
+        }
+
+        // pushes the packet of a complete frame to the incoming queue
+        // body buffer is taken from the pool, its ownership travels with the packet
+        bool addFrame(const PacketHeader<pR>& header, std::span<const uint8_t> body) {
+            connPacketBuffer.header = header;
+            connBufferPool.release(std::move(connPacketBuffer.body));
+            if (header.hasFlag(packetFlags::compressed)) {
+                if (!inflate(header, body, connPacketBuffer.body)) {
+                    print::error("read() - error: invalid compressed packet");
+                    return false;
+                }
+                // handlers see the packet as it was before compression
+                connPacketBuffer.header.setFlag(packetFlags::compressed, false);
+                connPacketBuffer.header.setBodySize(connPacketBuffer.body.size());
+            } else {
+                connPacketBuffer.body = connBufferPool.acquire(body.size());
+                connPacketBuffer.body.assign(body.begin(), body.end());
+            }
+            addToIncomingPacketQueue();
+            return true;
+        }
+
+        // collects the parts of a fragmented body, the packet is pushed to the incoming queue with its last part
+        // returns false if the parts do not belong together or the body outgrows the limit of the connection
+        bool reassemble(const PacketHeader<pR>& header, std::span<const uint8_t> part) {
+            Packet<pR>& packet = connReassembly[pR::laneOf(header.packetType)];
+            // the stored header keeps the fragment flag while parts are missing
+            if (!packet.header.hasFlag(packetFlags::fragment)) {
+                packet.header = header;
+                packet.body = connBufferPool.acquire(part.size());
+            } else if (packet.header.packetType != header.packetType
+                || packet.header.hasFlag(packetFlags::compressed) != header.hasFlag(packetFlags::compressed)) {
+                print::error("read() - error: fragment does not belong to the body under reassembly");
+                return false;
+            }
+            if (packet.body.size() + part.size() > connMaxFrameSize) {
+                print::error("read() - error: fragmented body exceeds the maximum frame size");
+                return false;
+            }
+            packet.body.insert(packet.body.end(), part.begin(), part.end());
+            if (!header.hasFlag(packetFlags::finalFragment)) return true;
+            PacketHeader<pR> wholeHeader = packet.header;
+            wholeHeader.setFlag(packetFlags::fragment | packetFlags::finalFragment, false);
+            wholeHeader.setBodySize(packet.body.size());
+            packet.header = PacketHeader<pR>();
+            if (!isAcceptableFrame(wholeHeader)) {
+                print::error(std::string("read() - error: invalid fragmented packet (type ") + std::to_string(int(wholeHeader.packetType)) 
+                    + std::string(", ") + std::to_string(wholeHeader.bodySize()) + std::string(" bytes)"));
+                return false;
+            }
+            if (wholeHeader.hasFlag(packetFlags::compressed)) {
+                bool inflated = addFrame(wholeHeader, packet.body);
+                connBufferPool.release(std::move(packet.body));
+                return inflated;
+            }
+            // the reassembled body is handed over as it is
+            connBufferPool.release(std::move(connPacketBuffer.body));
+            connPacketBuffer.header = wholeHeader;
+            connPacketBuffer.body = std::move(packet.body);
+            addToIncomingPacketQueue();
+            return true;
+        }
+
+        // moves the incomplete frame to the front of the receive buffer
+        // and grows the buffer if that frame would not fit in it, a grown buffer is shrunk back
+        // to the default size once the data left in it fits, so one large frame does not keep its memory
+        void prepareReadBuffer() {
+            if (connReadStart > 0) {
+                std::memmove(connReadBuffer.data(), connReadBuffer.data() + connReadStart, connReadEnd - connReadStart);
+                connReadEnd -= connReadStart;
+                connReadStart = 0;
+            }
+            size_t requiredSize = sizeof(PacketHeader<pR>);
+            if (connReadEnd >= sizeof(PacketHeader<pR>)) {
+                PacketHeader<pR> header;
+                std::memcpy(&header, connReadBuffer.data(), sizeof(PacketHeader<pR>));
+                requiredSize += header.bodySize();
+            }
+            if (connReadBuffer.size() < requiredSize) {
+                connReadBuffer.resize(requiredSize);
+            } else if (connReadBuffer.size() > DEFAULT_READ_BUFFER_SIZE 
+                && std::max(requiredSize, connReadEnd) <= DEFAULT_READ_BUFFER_SIZE) {
+                std::vector<uint8_t> shrunk(DEFAULT_READ_BUFFER_SIZE);
+                std::memcpy(shrunk.data(), connReadBuffer.data(), connReadEnd);
+                connReadBuffer = std::move(shrunk);
+            }
+        }
+
         // forms an independent metaPacket from the packet buffer and pushes it to the incoming queue
+        // the body is moved, not copied, the buffer goes back to the pool once the packet is processed
         void addToIncomingPacketQueue() {
-            MetaPacket<pT, pS> p;
-            p.content = connPacketBuffer;
+            MetaPacket<pR> p;
+            p.content = std::move(connPacketBuffer);
             p.packetConn = this->shared_from_this();
             std::strcpy(p.senderPublicKey, publicKey);
-            connPacketsIn.push_back(p);
+            connPendingPackets++;
+            // the channel can hold as many packets as the high watermark, so it is only full if the limits were changed,
+            // the packet then waits for room, it never takes another path than the ones received before it
+            if (connReceiving) {
+                if (connReceiveChannel.try_send(boost::system::error_code(), std::move(p))) return;
+                connChannelBlocked = true;
+                connReceiveChannel.async_send(
+                    boost::system::error_code(),
+                    std::move(p),
+                    [self = this->shared_from_this()] (boost::system::error_code ec) {
+                        if (ec || self->connFailed) return;
+                        self->connChannelBlocked = false;
+                        self->processReadBuffer();
+                    }
+                );
+                return;
+            }
+            if (connDeliver) {
+                connDeliver(p);
+                return;
+            }
+            connPacketsIn.push_back(std::move(p));
             print::trace("addToIncomingMessageQueue(): successfully processed incoming packet");
         }
 };
\ No newline at end of file
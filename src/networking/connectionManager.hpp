@@ -0,0 +1,153 @@
+// Copyright (c) 2022 Dániel Gergely, Dénes Balogh
+// Distributed under the MIT License.
+
+#pragma once
+#include "common.hpp"
+
+// keeps the number of open connections of an endpoint bounded
+// connections idle for longer than 'idleTimeout' are closed by a periodic sweep, and once there are more than
+// 'maxConnections', the least recently active ones are closed right away
+// closed connections go through the usual disconnection of the endpoint, so the routing table keeps their address
+// and assureConnection() opens them again when they are needed
+// a connection that still has packets to write is not closed, it is considered again by the next sweep
+template <typename pR> class ConnectionManager {
+    public:
+        // zero disables closing idle connections
+        std::chrono::milliseconds idleTimeout = DEFAULT_IDLE_TIMEOUT;
+        // zero disables the limit
+        size_t maxConnections = DEFAULT_MAX_CONNECTIONS;
+        std::chrono::milliseconds sweepInterval = DEFAULT_SWEEP_INTERVAL;
+        // connections closed for being idle and for exceeding the limit
+        std::atomic<size_t> idleEvictions = 0;
+        std::atomic<size_t> limitEvictions = 0;
+
+    private:
+        std::mutex containerMutex;
+        // validated connections that have not been closed by the manager yet
+        std::vector<std::weak_ptr<Connection<pR>>> tracked;
+        steady_timer sweepTimer;
+        // declared last, so it ends first and a sweep that is already due can not reach a half destroyed manager
+        Lifetime lifetime;
+
+    public:
+        ConnectionManager(io_context& _IOContext) : sweepTimer(_IOContext) {}
+        ConnectionManager(const ConnectionManager&) = delete;
+
+        // async - starts sweeping periodically
+        void start() {
+            sweepTimer.expires_after(sweepInterval);
+            sweepTimer.async_wait([this, alive = lifetime.watch()] (const boost::system::error_code& ec) {
+                Lifetime::Guard guard = alive.lock();
+                if (ec || !guard) return;
+                sweep();
+                start();
+            });
+        }
+
+        void stop() {
+            sweepTimer.cancel();
+        }
+
+        // a connection was validated, it may push out the least recently active one
+        void track(std::shared_ptr<Connection<pR>> conn) {
+            std::vector<std::shared_ptr<Connection<pR>>> evicted;
+            {
+                std::scoped_lock lock(containerMutex);
+                tracked.push_back(conn);
+                if (maxConnections > 0 && tracked.size() > maxConnections) {
+                    std::vector<std::shared_ptr<Connection<pR>>> open = openConnections();
+                    evicted = leastRecentlyActive(open, open.size() > maxConnections ? open.size() - maxConnections : 0);
+                    untrack(evicted);
+                }
+            }
+            for (std::shared_ptr<Connection<pR>>& victim : evicted) {
+                print::debug(std::string("ConnectionManager::track(): closing least recently active connection to ") + victim->publicKey);
+                evict(victim, limitEvictions);
+            }
+        }
+
+        // connections open and tracked
+        size_t count() {
+            std::scoped_lock lock(containerMutex);
+            return openConnections().size();
+        }
+
+        // closes the idle connections, and the least recently active ones above the limit
+        void sweep() {
+            std::vector<std::shared_ptr<Connection<pR>>> idle;
+            std::vector<std::shared_ptr<Connection<pR>>> evicted;
+            {
+                std::scoped_lock lock(containerMutex);
+                std::vector<std::shared_ptr<Connection<pR>>> open = openConnections();
+                if (idleTimeout.count() > 0) {
+                    auto idleSince = std::chrono::steady_clock::now() - idleTimeout;
+                    std::erase_if(open, [&idle, idleSince] (std::shared_ptr<Connection<pR>>& conn) {
+                        if (conn->lastActivity() > idleSince) return false;
+                        idle.push_back(conn);
+                        return true;
+                    });
+                }
+                if (maxConnections > 0 && open.size() > maxConnections) {
+                    evicted = leastRecentlyActive(open, open.size() - maxConnections);
+                }
+                untrack(idle);
+                untrack(evicted);
+            }
+            for (std::shared_ptr<Connection<pR>>& conn : idle) {
+                print::debug(std::string("ConnectionManager::sweep(): closing idle connection to ") + conn->publicKey);
+                evict(conn, idleEvictions);
+            }
+            for (std::shared_ptr<Connection<pR>>& conn : evicted) evict(conn, limitEvictions);
+        }
+
+    private:
+        // closes the connection on its io thread, where its outgoing lanes can be looked at,
+        // if they still have packets it is tracked again instead, so eviction never drops queued packets
+        void evict(std::shared_ptr<Connection<pR>> conn, std::atomic<size_t>& evictions) {
+            post(conn->connIOContext, [this, conn, &evictions, alive = lifetime.watch()] () {
+                Lifetime::Guard guard = alive.lock();
+                if (!guard || !conn->isOpen()) return;
+                if (conn->hasOutgoingPackets()) {
+                    print::debug(std::string("ConnectionManager::evict(): ") + conn->publicKey + " still has packets to write, kept open");
+                    std::scoped_lock lock(containerMutex);
+                    tracked.push_back(conn);
+                    return;
+                }
+                evictions++;
+                boost::system::error_code ec;
+                conn->connSocket.close(ec);
+                conn->fail();
+            });
+        }
+
+        // drops the connections that are gone or closed elsewhere
+        std::vector<std::shared_ptr<Connection<pR>>> openConnections() {
+            std::vector<std::shared_ptr<Connection<pR>>> open;
+            std::erase_if(tracked, [&open] (std::weak_ptr<Connection<pR>>& weakConn) {
+                std::shared_ptr<Connection<pR>> conn = weakConn.lock();
+                if (!conn || !conn->isOpen()) return true;
+                open.push_back(conn);
+                return false;
+            });
+            return open;
+        }
+
+        static std::vector<std::shared_ptr<Connection<pR>>> leastRecentlyActive(
+            std::vector<std::shared_ptr<Connection<pR>>>& conns,
+            size_t count
+        ) {
+            count = std::min(count, conns.size());
+            std::partial_sort(conns.begin(), conns.begin() + count, conns.end(), [] (auto& a, auto& b) {
+                return a->lastActivity() < b->lastActivity();
+            });
+            return std::vector<std::shared_ptr<Connection<pR>>>(conns.begin(), conns.begin() + count);
+        }
+
+        void untrack(const std::vector<std::shared_ptr<Connection<pR>>>& conns) {
+            if (conns.empty()) return;
+            std::erase_if(tracked, [&conns] (std::weak_ptr<Connection<pR>>& weakConn) {
+                std::shared_ptr<Connection<pR>> conn = weakConn.lock();
+                return std::find(conns.begin(), conns.end(), conn) != conns.end();
+            });
+        }
+};
@@ -0,0 +1,351 @@
+// Copyright (c) 2022 Dániel Gergely, Dénes Balogh
+// Distributed under the MIT License.
+
+#pragma once
+#include "common.hpp"
+
+// identifier of a node in the dht, the hash of its public key
+typedef uint64_t DHTNodeId;
+
+// kademlia style distributed hash table, resolves a public key to an address in O(log n) hops
+// the distance of two nodes is the xor of their identifiers, contacts are kept in k-buckets by their distance,
+// and a lookup queries ever closer nodes, several at a time, until one of them knows the target
+// only the routing state and the lookups are kept here, the packets are sent by the endpoint through 'send'
+template <typename pR> class DHT {
+    public:
+        // called with the contact of the target, or with nothing if it could not be found
+        typedef std::function<void(std::optional<DHTContact>)> LookupCallback;
+        // called with the closest nodes that answered a lookup
+        typedef std::function<void(std::vector<DHTContact>)> ClosestCallback;
+
+        // sends a packet to a contact, 'fail' has to be called if the contact can not be reached
+        std::function<void(const DHTContact&, Packet<pR>, std::function<void()>)> send;
+        // lookups finished, and the hops they needed together, a hop is a round of queries towards the target
+        std::atomic<size_t> lookupCount = 0;
+        std::atomic<size_t> lookupHops = 0;
+
+    private:
+        static constexpr size_t bucketCount = sizeof(DHTNodeId) * 8;
+
+        struct Candidate {
+            DHTContact contact;
+            DHTNodeId distance;
+            // the candidate was learnt from the answer of a node this many hops away
+            size_t hops;
+            enum { fresh, queried, answered, failed } state;
+        };
+
+        struct Lookup {
+            NodeKey target;
+            DHTNodeId targetId;
+            // whether the lookup stops at the first node knowing the target
+            bool findTarget;
+            // ordered by distance from the target
+            std::vector<Candidate> candidates;
+            size_t inFlight = 0;
+            std::unique_ptr<steady_timer> timer;
+            LookupCallback onFound;
+            ClosestCallback onClosest;
+        };
+
+        io_context& dhtIOContext;
+        std::mutex containerMutex;
+        NodeKey localKey;
+        DHTNodeId localId = 0;
+        // bucket i holds the contacts whose distance has its highest set bit at i, the least recently seen first
+        std::array<std::vector<DHTContact>, bucketCount> buckets;
+        std::unordered_map<uint64_t, Lookup> lookups;
+        // lookup ids are drawn from here, so a node that was not asked can not guess them
+        std::random_device randomSource;
+        // declared last, so it ends first and the timers of the lookups can not reach a half destroyed table
+        Lifetime lifetime;
+
+    public:
+        DHT(io_context& _IOContext) : dhtIOContext(_IOContext) {}
+        DHT(const DHT&) = delete;
+
+        void setLocalKey(const NodeKey& _localKey) {
+            std::scoped_lock lock(containerMutex);
+            localKey = _localKey;
+            localId = _localKey.hash();
+        }
+
+        static DHTNodeId idOf(const char* _publicKey) {
+            return NodeKey(_publicKey).hash();
+        }
+
+        // a node was seen alive, it becomes the most recently seen of its bucket
+        // a full bucket keeps its old contacts, long living nodes are the most likely to stay
+        void observe(const DHTContact& contact) {
+            std::scoped_lock lock(containerMutex);
+            DHTNodeId id = idOf(contact.publicKey);
+            if (id == localId) return;
+            std::vector<DHTContact>& bucket = buckets[bucketOf(id)];
+            auto known = std::find_if(bucket.begin(), bucket.end(), [&contact] (const DHTContact& c) {
+                return NodeKey(c.publicKey) == NodeKey(contact.publicKey);
+            });
+            if (known != bucket.end()) bucket.erase(known);
+            else if (bucket.size() >= DHT_BUCKET_SIZE) return;
+            bucket.push_back(contact);
+        }
+
+        // a node could not be reached
+        void remove(const NodeKey& key) {
+            std::scoped_lock lock(containerMutex);
+            std::vector<DHTContact>& bucket = buckets[bucketOf(key.hash())];
+            std::erase_if(bucket, [&key] (const DHTContact& c) {
+                return NodeKey(c.publicKey) == key;
+            });
+        }
+
+        size_t count() {
+            std::scoped_lock lock(containerMutex);
+            size_t contactCount = 0;
+            for (std::vector<DHTContact>& bucket : buckets) contactCount += bucket.size();
+            return contactCount;
+        }
+
+        // at most 'maxCount' known contacts ordered by their distance from 'target'
+        std::vector<DHTContact> closest(DHTNodeId target, size_t maxCount = DHT_BUCKET_SIZE) {
+            std::scoped_lock lock(containerMutex);
+            return closestContacts(target, maxCount);
+        }
+
+        // async - looks for the address of a node
+        void lookup(const NodeKey& target, LookupCallback callback) {
+            startLookup(target, true, std::move(callback), [](std::vector<DHTContact>){});
+        }
+
+        // async - looks for the nodes closest to the local node and announces it to them
+        void join(std::function<void(size_t)> callback = [](size_t){}) {
+            startLookup(
+                localKey,
+                false,
+                [](std::optional<DHTContact>){},
+                [this, callback] (std::vector<DHTContact> closestNodes) {
+                    DHTStorePayload store = {};
+                    std::memcpy(store.contact.publicKey, localKey.c_str(), sizeof(store.contact.publicKey));
+                    for (DHTContact& contact : closestNodes) {
+                        send(contact, Packet<pR>::template of<typename pR::template spec<pR::type::dhtStore>>(store), [](){});
+                    }
+                    print::debug(std::string("DHT::join(): announced to ") + std::to_string(closestNodes.size()) + std::string(" nodes"));
+                    callback(closestNodes.size());
+                }
+            );
+        }
+
+        // answer to a find node request
+        // 'exact' is the contact of the target if the local node knows its address from elsewhere
+        DHTNodesPayload answer(const DHTFindNodePayload& request, std::optional<DHTContact> exact) {
+            DHTNodesPayload reply = {};
+            reply.lookupId = request.lookupId;
+            std::memcpy(reply.target, request.target, sizeof(reply.target));
+            NodeKey target(request.target);
+            if (exact) reply.contacts[reply.count++] = *exact;
+            for (DHTContact& contact : closest(target.hash())) {
+                if (reply.count == DHT_BUCKET_SIZE) break;
+                if (exact && NodeKey(contact.publicKey) == target) continue;
+                reply.contacts[reply.count++] = contact;
+            }
+            return reply;
+        }
+
+        // drops the lookups under way without calling their callbacks, their timers are cancelled
+        void stop() {
+            std::unordered_map<uint64_t, Lookup> dropped;
+            {
+                std::scoped_lock lock(containerMutex);
+                dropped.swap(lookups);
+            }
+        }
+
+        // a node answered a lookup of the local node
+        void onNodes(const DHTNodesPayload& reply, const NodeKey& sender) {
+            std::vector<std::function<void()>> actions;
+            {
+                std::scoped_lock lock(containerMutex);
+                auto it = lookups.find(reply.lookupId);
+                if (it == lookups.end()) return;
+                Lookup& lookup = it->second;
+                size_t hops = 0;
+                bool queried = false;
+                for (Candidate& candidate : lookup.candidates) {
+                    if (candidate.state != Candidate::queried || NodeKey(candidate.contact.publicKey) != sender) continue;
+                    candidate.state = Candidate::answered;
+                    hops = candidate.hops + 1;
+                    lookup.inFlight--;
+                    queried = true;
+                }
+                // only the nodes asked by the lookup may add contacts to it
+                if (!queried) {
+                    print::debug(std::string("DHT::onNodes(): unexpected answer from ") + sender.c_str() + ", dropped");
+                    return;
+                }
+                for (size_t i = 0; i < std::min<size_t>(reply.count, DHT_BUCKET_SIZE); i++) {
+                    DHTContact contact = reply.contacts[i];
+                    contact.publicKey[sizeof(contact.publicKey) - 1] = '\0';
+                    contact.ipAddress[sizeof(contact.ipAddress) - 1] = '\0';
+                    NodeKey key(contact.publicKey);
+                    if (lookup.findTarget && key == lookup.target) {
+                        finish(reply.lookupId, hops, contact, actions);
+                        break;
+                    }
+                    addCandidate(lookup, contact, hops);
+                }
+                if (lookups.count(reply.lookupId)) advance(reply.lookupId, actions);
+            }
+            for (std::function<void()>& action : actions) action();
+        }
+
+    private:
+        // random, nonzero and not used by a lookup under way, has to be called with the lock held
+        uint64_t newLookupId() {
+            uint64_t lookupId = 0;
+            while (lookupId == 0 || lookups.contains(lookupId)) {
+                lookupId = (uint64_t(randomSource()) << 32) | randomSource();
+            }
+            return lookupId;
+        }
+
+        size_t bucketOf(DHTNodeId id) {
+            DHTNodeId distance = id ^ localId;
+            return distance == 0 ? 0 : bucketCount - 1 - std::countl_zero(distance);
+        }
+
+        std::vector<DHTContact> closestContacts(DHTNodeId target, size_t maxCount) {
+            std::vector<DHTContact> contacts;
+            for (std::vector<DHTContact>& bucket : buckets) contacts.insert(contacts.end(), bucket.begin(), bucket.end());
+            auto closer = [target] (const DHTContact& a, const DHTContact& b) {
+                return (idOf(a.publicKey) ^ target) < (idOf(b.publicKey) ^ target);
+            };
+            size_t resultCount = std::min(maxCount, contacts.size());
+            std::partial_sort(contacts.begin(), contacts.begin() + resultCount, contacts.end(), closer);
+            contacts.resize(resultCount);
+            return contacts;
+        }
+
+        void startLookup(const NodeKey& target, bool findTarget, LookupCallback onFound, ClosestCallback onClosest) {
+            std::vector<std::function<void()>> actions;
+            {
+                std::scoped_lock lock(containerMutex);
+                uint64_t lookupId = newLookupId();
+                Lookup& lookup = lookups[lookupId];
+                lookup.target = target;
+                lookup.targetId = target.hash();
+                lookup.findTarget = findTarget;
+                lookup.onFound = std::move(onFound);
+                lookup.onClosest = std::move(onClosest);
+                for (DHTContact& contact : closestContacts(lookup.targetId, DHT_BUCKET_SIZE)) {
+                    if (findTarget && NodeKey(contact.publicKey) == target) {
+                        finish(lookupId, 0, contact, actions);
+                        break;
+                    }
+                    addCandidate(lookup, contact, 0);
+                }
+                if (lookups.count(lookupId)) {
+                    lookup.timer = std::make_unique<steady_timer>(dhtIOContext, DHT_LOOKUP_TIMEOUT);
+                    lookup.timer->async_wait([this, lookupId, alive = lifetime.watch()] (const boost::system::error_code& ec) {
+                        Lifetime::Guard guard = alive.lock();
+                        if (ec || !guard) return;
+                        timeout(lookupId);
+                    });
+                    advance(lookupId, actions);
+                }
+            }
+            for (std::function<void()>& action : actions) action();
+        }
+
+        void addCandidate(Lookup& lookup, const DHTContact& contact, size_t hops) {
+            NodeKey key(contact.publicKey);
+            if (key == localKey) return;
+            for (Candidate& candidate : lookup.candidates) {
+                if (NodeKey(candidate.contact.publicKey) == key) return;
+            }
+            Candidate candidate = { contact, key.hash() ^ lookup.targetId, hops, Candidate::fresh };
+            auto position = std::upper_bound(
+                lookup.candidates.begin(),
+                lookup.candidates.end(),
+                candidate.distance,
+                [] (DHTNodeId distance, const Candidate& c) {
+                    return distance < c.distance;
+                }
+            );
+            lookup.candidates.insert(position, candidate);
+        }
+
+        // queries the closest fresh candidates, at most 'DHT_PARALLELISM' at a time
+        // the lookup is over once the closest 'DHT_BUCKET_SIZE' reachable candidates have all answered
+        void advance(uint64_t lookupId, std::vector<std::function<void()>>& actions) {
+            Lookup& lookup = lookups.at(lookupId);
+            size_t considered = 0;
+            for (Candidate& candidate : lookup.candidates) {
+                if (lookup.inFlight >= DHT_PARALLELISM || considered == DHT_BUCKET_SIZE) break;
+                if (candidate.state == Candidate::failed) continue;
+                considered++;
+                if (candidate.state != Candidate::fresh) continue;
+                candidate.state = Candidate::queried;
+                lookup.inFlight++;
+                DHTFindNodePayload request = {};
+                request.lookupId = lookupId;
+                std::memcpy(request.target, lookup.target.c_str(), sizeof(request.target));
+                DHTContact contact = candidate.contact;
+                actions.push_back([this, lookupId, contact, request] () {
+                    send(
+                        contact,
+                        Packet<pR>::template of<typename pR::template spec<pR::type::dhtFindNode>>(request),
+                        [this, lookupId, contact] () {
+                            unreachable(lookupId, contact);
+                        }
+                    );
+                });
+            }
+            if (lookup.inFlight == 0) finish(lookupId, 0, std::nullopt, actions);
+        }
+
+        void unreachable(uint64_t lookupId, const DHTContact& contact) {
+            remove(NodeKey(contact.publicKey));
+            std::vector<std::function<void()>> actions;
+            {
+                std::scoped_lock lock(containerMutex);
+                auto it = lookups.find(lookupId);
+                if (it == lookups.end()) return;
+                for (Candidate& candidate : it->second.candidates) {
+                    if (candidate.state != Candidate::queried || NodeKey(candidate.contact.publicKey) != NodeKey(contact.publicKey)) continue;
+                    candidate.state = Candidate::failed;
+                    it->second.inFlight--;
+                }
+                advance(lookupId, actions);
+            }
+            for (std::function<void()>& action : actions) action();
+        }
+
+        void timeout(uint64_t lookupId) {
+            std::vector<std::function<void()>> actions;
+            {
+                std::scoped_lock lock(containerMutex);
+                if (!lookups.count(lookupId)) return;
+                print::debug("DHT::lookup(): lookup timed out");
+                finish(lookupId, 0, std::nullopt, actions);
+            }
+            for (std::function<void()>& action : actions) action();
+        }
+
+        // removes the lookup, its callbacks are run once the lock is released
+        void finish(uint64_t lookupId, size_t hops, std::optional<DHTContact> found, std::vector<std::function<void()>>& actions) {
+            Lookup& lookup = lookups.at(lookupId);
+            if (lookup.timer) lookup.timer->cancel();
+            if (found) {
+                lookupCount++;
+                lookupHops += hops;
+            }
+            std::vector<DHTContact> answered;
+            for (Candidate& candidate : lookup.candidates) {
+                if (candidate.state == Candidate::answered && answered.size() < DHT_BUCKET_SIZE) answered.push_back(candidate.contact);
+            }
+            actions.push_back([onFound = std::move(lookup.onFound), onClosest = std::move(lookup.onClosest), found, answered] () {
+                onFound(found);
+                onClosest(answered);
+            });
+            lookups.erase(lookupId);
+        }
+};
@@ -0,0 +1,172 @@
+// Copyright (c) 2022 Dániel Gergely, Dénes Balogh
+// Distributed under the MIT License.
+
+#pragma once
+#include "common.hpp"
+
+// lookups of a node through its parent node in a hierarchy of relays
+// answers are cached with a time to live, found and missing nodes separately,
+// a full cache makes room by dropping the entry that expires first,
+// and the lookups of the same public key waiting for the parent share one query
+// only the cache and the waiting lookups are kept here, the queries are sent by the endpoint through 'sendToParent'
+template <typename pR> class Directory {
+    public:
+        // called with the contact of the target, or with nothing if the parent does not know it either
+        typedef std::function<void(std::optional<DHTContact>)> LookupCallback;
+
+        // sends a query to the parent node, 'fail' has to be called if the parent can not be reached
+        std::function<void(Packet<pR>, std::function<void()>)> sendToParent;
+        std::chrono::milliseconds positiveTTL = DEFAULT_DIRECTORY_POSITIVE_TTL;
+        std::chrono::milliseconds negativeTTL = DEFAULT_DIRECTORY_NEGATIVE_TTL;
+        size_t cacheCapacity = DIRECTORY_CACHE_SIZE;
+        // lookups answered from the cache, and queries sent to the parent
+        std::atomic<size_t> cacheHits = 0;
+        std::atomic<size_t> parentQueries = 0;
+
+    private:
+        typedef std::multimap<std::chrono::steady_clock::time_point, NodeKey> ExpiryIndex;
+
+        struct CacheEntry {
+            std::optional<DHTContact> contact;
+            // position of the entry in 'expiries', which holds its expiry
+            typename ExpiryIndex::iterator expiry;
+        };
+
+        struct Query {
+            NodeKey target;
+            std::vector<LookupCallback> callbacks;
+            std::unique_ptr<steady_timer> timer;
+        };
+
+        io_context& directoryIOContext;
+        std::mutex containerMutex;
+        std::unordered_map<NodeKey, CacheEntry, NodeKeyHash> cache;
+        // the cached public keys ordered by their expiry
+        ExpiryIndex expiries;
+        // queries waiting for the parent, by their id and by their target
+        std::unordered_map<uint64_t, Query> queries;
+        std::unordered_map<NodeKey, uint64_t, NodeKeyHash> queriesByTarget;
+        // query ids are drawn from here, so a node that did not see a query can not guess its id
+        std::random_device randomSource;
+        // declared last, so it ends first and the timers of the queries can not reach a half destroyed directory
+        Lifetime lifetime;
+
+    public:
+        Directory(io_context& _IOContext) : directoryIOContext(_IOContext) {}
+        Directory(const Directory&) = delete;
+
+        // async - looks for the address of a node in the cache, then at the parent node
+        void lookup(const NodeKey& target, LookupCallback callback) {
+            std::optional<std::optional<DHTContact>> cached;
+            uint64_t queryId = 0;
+            {
+                std::scoped_lock lock(containerMutex);
+                auto entry = cache.find(target);
+                if (entry != cache.end() && entry->second.expiry->first > std::chrono::steady_clock::now()) {
+                    cached = entry->second.contact;
+                } else if (auto waiting = queriesByTarget.find(target); waiting != queriesByTarget.end()) {
+                    // the parent is already asked, the answer is shared
+                    queries.at(waiting->second).callbacks.push_back(std::move(callback));
+                    return;
+                } else {
+                    queryId = newQueryId();
+                    Query& query = queries[queryId];
+                    query.target = target;
+                    query.callbacks.push_back(std::move(callback));
+                    query.timer = std::make_unique<steady_timer>(directoryIOContext, DIRECTORY_LOOKUP_TIMEOUT);
+                    query.timer->async_wait([this, queryId, alive = lifetime.watch()] (const boost::system::error_code& ec) {
+                        Lifetime::Guard guard = alive.lock();
+                        if (ec || !guard) return;
+                        print::debug("Directory::lookup(): parent node did not answer in time");
+                        complete(queryId, std::nullopt, false);
+                    });
+                    queriesByTarget[target] = queryId;
+                }
+            }
+            if (cached) {
+                cacheHits++;
+                callback(*cached);
+                return;
+            }
+            parentQueries++;
+            DirectoryQueryPayload request = {};
+            request.queryId = queryId;
+            std::memcpy(request.target, target.c_str(), sizeof(request.target));
+            sendToParent(
+                Packet<pR>::template of<typename pR::template spec<pR::type::directoryQuery>>(request),
+                [this, queryId] () {
+                    print::error("Directory::lookup() - error: parent node is unreachable");
+                    complete(queryId, std::nullopt, false);
+                }
+            );
+        }
+
+        // drops the queries waiting for the parent without calling their callbacks, their timers are cancelled
+        void stop() {
+            std::unordered_map<uint64_t, Query> dropped;
+            {
+                std::scoped_lock lock(containerMutex);
+                dropped.swap(queries);
+                queriesByTarget.clear();
+            }
+        }
+
+        size_t cacheSize() {
+            std::scoped_lock lock(containerMutex);
+            return cache.size();
+        }
+
+        // the parent node answered a query of this node
+        void onAnswer(const DirectoryAnswerPayload& answer) {
+            std::optional<DHTContact> contact;
+            if (answer.found) {
+                contact = answer.contact;
+                contact->publicKey[sizeof(contact->publicKey) - 1] = '\0';
+                contact->ipAddress[sizeof(contact->ipAddress) - 1] = '\0';
+            }
+            complete(answer.queryId, contact, true);
+        }
+
+    private:
+        // random, nonzero and not used by a waiting query, has to be called with the lock held
+        uint64_t newQueryId() {
+            uint64_t queryId = 0;
+            while (queryId == 0 || queries.contains(queryId)) {
+                queryId = (uint64_t(randomSource()) << 32) | randomSource();
+            }
+            return queryId;
+        }
+
+        // answers are cached, failures to reach the parent are not
+        void complete(uint64_t queryId, std::optional<DHTContact> contact, bool cacheable) {
+            std::vector<LookupCallback> callbacks;
+            {
+                std::scoped_lock lock(containerMutex);
+                auto it = queries.find(queryId);
+                if (it == queries.end()) return;
+                Query& query = it->second;
+                if (query.timer) query.timer->cancel();
+                if (cacheable) store(query.target, contact);
+                callbacks = std::move(query.callbacks);
+                queriesByTarget.erase(query.target);
+                queries.erase(it);
+            }
+            for (LookupCallback& callback : callbacks) callback(contact);
+        }
+
+        // caches an answer, the expired entries go first, then the ones expiring first while the cache is full
+        void store(const NodeKey& target, const std::optional<DHTContact>& contact) {
+            auto now = std::chrono::steady_clock::now();
+            if (auto entry = cache.find(target); entry != cache.end()) {
+                expiries.erase(entry->second.expiry);
+                cache.erase(entry);
+            }
+            while (!expiries.empty() && (expiries.begin()->first <= now || cache.size() >= cacheCapacity)) {
+                cache.erase(expiries.begin()->second);
+                expiries.erase(expiries.begin());
+            }
+            if (cacheCapacity == 0) return;
+            auto expiry = expiries.emplace(now + (contact ? positiveTTL : negativeTTL), target);
+            cache[target] = { contact, expiry };
+        }
+};
@@ -4,34 +4,129 @@
 #pragma once
 #include "common.hpp"
 
-template <typename pT, int* pS> class Endpoint : public std::enable_shared_from_this<Endpoint<pT, pS>> {
+// where the handlers of the incoming packets run
+enum class DispatchMode {
+    // on the thread calling update(), one packet after the other
+    caller,
+    // on the dispatch pool, the packets of a connection are handled in order on its own strand
+    connectionStrand,
+    // on the dispatch pool, senders are sharded over a fixed set of strands by the hash of their public key
+    keyHash,
+    // on the io thread that read the packet, without the incoming queue and update()
+    // the packets of a connection are handled in order, the reading of the connection waits for its handlers
+    ioThread
+};
+
+// 'nodeT' is the derived node class, incoming packets are dispatched to its handlers without virtual calls
+template <typename pR, typename nodeT> class Endpoint : public std::enable_shared_from_this<Endpoint<pR, nodeT>> {
     public:
-        // incoming packet queue
-        Queue<MetaPacket<pT, pS>> packetsIn;
-        // shared across whole endpoint instance
-        io_context asioContext;
-        std::thread contextThread;
-        ip::tcp::acceptor asioAcceptor;
+        // runs the handlers in the pool modes, update() only hands the packets over to it
+        // declared first, so it outlives the queued packets and connections holding its strands
+        std::unique_ptr<thread_pool> dispatchPool;
+        // incoming packet queue, filled by every connection and drained by update()
+        Queue<MetaPacket<pR>> packetsIn;
+        // packets under processing by updateBatch(), reused between batches
+        std::vector<MetaPacket<pR>> packetBatch;
+        // recycles the bodies of incoming packets
+        BufferPool bufferPool;
+        // io threads of the endpoint, each connection is bound to one of their contexts
+        IOContextPool ioPool;
+        // first shard of the pool, resolving and other endpoint level work runs on it
+        io_context& asioContext;
+        // with more than one shard there is an acceptor on each, sharing the port where the platform allows it
+        std::vector<ip::tcp::acceptor> acceptors;
+        // pins io thread i to cpu i, has to be set before start()
+        bool pinIOThreads = false;
         // will be the public key of node instance
         char publicKey[5];
         uint16_t port;
+        // largest body accepted from or sent to remote nodes
+        uint32_t maxFrameSize;
+        // wire features offered to remote nodes
+        uint32_t capabilities = nodeCapabilities::all;
+        // connections stop reading while they or the incoming queue have too many packets waiting
+        Watermarks connectionWatermarks = { DEFAULT_CONNECTION_HIGH_WATERMARK, DEFAULT_CONNECTION_LOW_WATERMARK };
+        Watermarks queueWatermarks = { DEFAULT_QUEUE_HIGH_WATERMARK, DEFAULT_QUEUE_LOW_WATERMARK };
+        // with a pool mode the handlers of different senders run concurrently, so they have to be thread-safe,
+        // the packets of one sender are still handled one at a time and in order, has to be set before start()
+        DispatchMode dispatchMode = DispatchMode::caller;
+        size_t dispatchThreads = std::max(1u, std::thread::hardware_concurrency());
+        // strands of the key hash mode
+        std::vector<strand<thread_pool::executor_type>> dispatchStrands;
         // routing table (public key -> ip, port, connection pointer)
-        RoutingTable<pT, pS> connections;
-        // parent node
-        ConnectionData<pT, pS>* parentNode;
+        RoutingTable<pR> connections;
+        // resolves the public keys missing from the routing table, if the protocol has the packet types of the dht
+        DHT<pR> dht;
+        // parent node in a hierarchy of relays, public keys missing from the routing table are looked up through it
+        std::optional<ConnectionData<pR>> parentNode;
+        // public key of the parent node, known once it was connected
+        std::optional<NodeKey> parentKey;
+        std::mutex parentMutex;
+        // nodes of the subtree registered at this node, with the child they were registered by,
+        // a child that registered itself is a node connected directly
+        std::unordered_map<NodeKey, NodeKey, NodeKeyHash> registeredBy;
+        std::mutex registryMutex;
+        // caches the answers of the parent node, if the protocol has the packet types of the directory
+        Directory<pR> directory;
+        // peers of this and earlier runs of the node, only used once opened by openPeerCache()
+        PeerCache peerCache;
+        // closes idle connections and keeps the number of open ones bounded
+        ConnectionManager<pR> connectionManager;
+        // packets sent to a node while it is being connected, more are dropped
+        size_t maxPendingPackets = DEFAULT_MAX_PENDING_PACKETS;
+        // nodes being connected by requestConnection(), with the work waiting for their connection
+        struct PendingConnection {
+            // tells the attempts for the same node apart, the reject callback of a connection outlives its attempt
+            uint64_t attempt;
+            std::vector<std::function<void(std::shared_ptr<Connection<pR>>)>> callbacks;
+            std::vector<Packet<pR>> packets;
+            // called if the attempt fails
+            std::vector<std::function<void()>> rejects;
+        };
+        std::unordered_map<NodeKey, PendingConnection, NodeKeyHash> pendingConnections;
+        std::mutex pendingMutex;
+        uint64_t nextConnectionAttempt = 1;
+        // every connection created by the endpoint, so stop() can close them, the freed ones are dropped as the list grows
+        std::vector<std::weak_ptr<Connection<pR>>> createdConnections;
+        size_t createdConnectionsLimit = DEFAULT_MAX_CONNECTIONS;
+        std::mutex createdMutex;
+        std::atomic<bool> stopped = false;
+        // declared last, so an accept handler that is already running is waited for before the members go
+        Lifetime lifetime;
 
         Endpoint(
             char* _publicKey, 
-            uint16_t _port
-        ) : asioAcceptor(
-            asioContext, 
-            ip::tcp::endpoint(ip::tcp::v4(), _port)
-        ) {
+            uint16_t _port,
+            uint32_t _maxFrameSize = DEFAULT_MAX_FRAME_SIZE,
+            size_t _ioThreads = 1
+        ) : ioPool(_ioThreads), asioContext(ioPool.get(0)), dht(asioContext), directory(asioContext), connectionManager(asioContext) {
+            openAcceptors(ip::tcp::endpoint(ip::tcp::v4(), _port));
             std::strcpy(publicKey, _publicKey);
             port = _port;
+            maxFrameSize = _maxFrameSize;
+            startDHT();
+            startDirectory();
+        }
+
+        // embeds the endpoint in an event loop of the caller, it runs all of its work on 'externalContext',
+        // which is started and stopped by the caller, and handles the incoming packets right where they are read
+        // the handlers have to be thread-safe if the context is run by more than one thread
+        Endpoint(
+            io_context& externalContext,
+            char* _publicKey, 
+            uint16_t _port,
+            uint32_t _maxFrameSize = DEFAULT_MAX_FRAME_SIZE
+        ) : ioPool(externalContext), asioContext(externalContext), dispatchMode(DispatchMode::ioThread), dht(asioContext), directory(asioContext), connectionManager(asioContext) {
+            openAcceptors(ip::tcp::endpoint(ip::tcp::v4(), _port));
+            std::strcpy(publicKey, _publicKey);
+            port = _port;
+            maxFrameSize = _maxFrameSize;
+            startDHT();
+            startDirectory();
         }
 
         virtual ~Endpoint() {
+            lifetime.end();
             stop();
         }
 
@@ -39,13 +134,13 @@ template <typename pT, int* pS> class Endpoint : public std::enable_shared_from_
         bool start() {
             try {
                 // starting to listen for remote connections
-                waitForConnection();
-                // launching asio context on its own thread 
-                contextThread = std::thread(
-                    [this] () { 
-                        asioContext.run();
-                    }
-                );
+                for (size_t i = 0; i < acceptors.size(); i++) waitForConnection(i);
+                connectionManager.start();
+                // launching the io threads, an external context is already run by its owner
+                ioPool.start(pinIOThreads);
+                if (dispatchMode == DispatchMode::connectionStrand || dispatchMode == DispatchMode::keyHash) {
+                    startDispatchPool();
+                }
             } catch (std::exception& e) {
                 print::error(std::string("start() - error: ") + std::string(e.what()));
                 return false;
@@ -54,9 +149,33 @@ template <typename pT, int* pS> class Endpoint : public std::enable_shared_from_
             return true;
         }
 
+        // stops the io threads and the dispatch pool, then closes the acceptors and the connections and drops the timers
+        // and the work waiting for connections, nothing queued on the contexts reaches the endpoint afterwards
+        // with an external context it has to be called on the thread running the context or after the context is stopped
         void stop() {
-            asioContext.stop();
-            if (contextThread.joinable()) contextThread.join();
+            if (stopped.exchange(true)) return;
+            ioPool.stop();
+            if (dispatchPool) {
+                dispatchPool->stop();
+                dispatchPool->join();
+            }
+            connectionManager.stop();
+            dht.stop();
+            directory.stop();
+            boost::system::error_code ec;
+            for (ip::tcp::acceptor& acceptor : acceptors) acceptor.close(ec);
+            std::vector<std::weak_ptr<Connection<pR>>> created;
+            {
+                std::scoped_lock lock(createdMutex);
+                created.swap(createdConnections);
+            }
+            for (std::weak_ptr<Connection<pR>>& weakConn : created) {
+                if (std::shared_ptr<Connection<pR>> conn = weakConn.lock()) conn->close();
+            }
+            {
+                std::scoped_lock lock(pendingMutex);
+                pendingConnections.clear();
+            }
             print::info("stop(): endpoint stopped");
         }
 
@@ -64,82 +183,205 @@ template <typename pT, int* pS> class Endpoint : public std::enable_shared_from_
         void connect(
             const std::string& host, 
             uint16_t port, 
-            std::function<void(std::shared_ptr<Connection<pT, pS>>)> callback = [](std::shared_ptr<Connection<pT, pS>>){},
-            std::function<void(std::shared_ptr<Connection<pT, pS>>)> reject = [](std::shared_ptr<Connection<pT, pS>>){}
+            std::function<void(std::shared_ptr<Connection<pR>>)> callback = [](std::shared_ptr<Connection<pR>>){},
+            std::function<void(std::shared_ptr<Connection<pR>>)> reject = [](std::shared_ptr<Connection<pR>>){}
         ) {
             try {
                 // dns lookup for the hostname
                 ip::tcp::resolver resolver(asioContext);
                 ip::tcp::resolver::results_type endpoints = resolver.resolve(host, std::to_string(port));
-                // creating connection instance
-                std::shared_ptr<Connection<pT, pS>> newConn =
-                    std::make_shared<Connection<pT, pS>> (
-                        asioContext, 
-                        ip::tcp::socket(asioContext), 
-                        packetsIn
-                    );
+                // creating connection instance on the next shard
+                io_context& shard = ioPool.next();
+                std::shared_ptr<Connection<pR>> newConn = createConnection(shard, ip::tcp::socket(shard));
                 // connecting to the remote node and validating connection
                 newConn->remoteConnect(
                     endpoints, 
                     publicKey, 
-                    [this, newConn, callback] (
-                        std::shared_ptr<Connection<pT, pS>> conn
+                    [this, callback] (
+                        std::shared_ptr<Connection<pR>> conn
                     ) {
-                        this->connections.set(
-                            conn->publicKey,
-                            conn->connSocket.remote_endpoint().address().to_string(),
-                            conn->connSocket.remote_endpoint().port(),
-                            conn->shared_from_this()
-                        );
+                        this->addConnection(conn);
                         callback(conn);
                     }, 
-                    [this, newConn, reject] (
-                        std::shared_ptr<Connection<pT, pS>> conn
+                    [this, reject] (
+                        std::shared_ptr<Connection<pR>> conn
                     ) {
-                        this->disconnect(conn->publicKey);
-                        //reject(conn);
+                        this->disconnect(conn->publicKey, conn);
+                        reject(conn);
                     }
                 );
             } catch (std::exception& e) {
                 print::error(std::string("connect() - error: ") + std::string(e.what()));
+                reject(nullptr);
+            }
+        }
+
+        // async - same as connect(), completes with the validated connection
+        // fails with 'connection_aborted' if connecting or the handshake fails
+        template <typename tokenT = use_awaitable_t<>> auto asyncConnect(
+            const std::string& host, 
+            uint16_t port, 
+            tokenT&& token = {}
+        ) {
+            return async_initiate<tokenT, void(boost::system::error_code, std::shared_ptr<Connection<pR>>)>(
+                [this, host, port] (auto handler) {
+                    // the reject callback stays with the connection after the handshake, 
+                    // so the handler is shared between the callbacks and completed only once
+                    auto pending = std::make_shared<std::optional<decltype(handler)>>(std::move(handler));
+                    auto complete = [this, pending] (boost::system::error_code ec, std::shared_ptr<Connection<pR>> conn) {
+                        if (!*pending) return;
+                        completeOn(asioContext.get_executor(), std::move(**pending), ec, conn);
+                        pending->reset();
+                    };
+                    connect(
+                        host,
+                        port,
+                        [complete] (std::shared_ptr<Connection<pR>> conn) mutable {
+                            complete(boost::system::error_code(), conn);
+                        },
+                        [complete] (std::shared_ptr<Connection<pR>> conn) mutable {
+                            complete(make_error_code(error::connection_aborted), conn);
+                        }
+                    );
+                },
+                token
+            );
+        }
+
+        // stores a validated connection in the routing table with the port the remote node listens on,
+        // the work waiting for the node is handed to it, the remote node becomes a contact of the dht 
+        // and is remembered in the peer cache, the connection manager may close the least recently active connection to make room for it
+        void addConnection(std::shared_ptr<Connection<pR>> conn) {
+            boost::system::error_code ec;
+            ip::tcp::endpoint remoteEndpoint = conn->connSocket.remote_endpoint(ec);
+            if (ec) return;
+            PendingConnection pending;
+            {
+                // the waiting packets are sent before the connection is published,
+                // so the ones sent through the routing table afterwards can not overtake them
+                std::scoped_lock lock(pendingMutex);
+                if (auto it = pendingConnections.find(NodeKey(conn->publicKey)); it != pendingConnections.end()) {
+                    pending = std::move(it->second);
+                    pendingConnections.erase(it);
+                }
+                // called on the io thread of the connection, after the handshake
+                for (Packet<pR>& packet : pending.packets) conn->sendFromIOThread(std::move(packet));
+                // older nodes do not send the port they listen on, the port of the socket is stored for them as before,
+                // but as that is only right for outgoing connections, they are not shared with the dht or the peer cache
+                connections.set(
+                    conn->publicKey,
+                    remoteEndpoint.address().to_string(),
+                    conn->connRemotePort ? conn->connRemotePort : remoteEndpoint.port(),
+                    conn
+                );
+            }
+            for (auto& callback : pending.callbacks) callback(conn);
+            connectionManager.track(conn);
+            if (!conn->connRemotePort) return;
+            if constexpr (pR::hasDHT) {
+                DHTContact contact = {};
+                std::memcpy(contact.publicKey, conn->publicKey, sizeof(contact.publicKey));
+                std::strncpy(contact.ipAddress, remoteEndpoint.address().to_string().c_str(), sizeof(contact.ipAddress) - 1);
+                contact.port = conn->connRemotePort;
+                dht.observe(contact);
+            }
+            peerCache.seen(conn->publicKey, remoteEndpoint.address().to_string(), conn->connRemotePort, conn->connConnectRTT);
+        }
+
+        // connection on 'shard' with the limits of the endpoint
+        std::shared_ptr<Connection<pR>> createConnection(io_context& shard, ip::tcp::socket socket) {
+            std::shared_ptr<Connection<pR>> newConn =
+                std::make_shared<Connection<pR>> (
+                    shard, 
+                    std::move(socket), 
+                    packetsIn,
+                    bufferPool,
+                    maxFrameSize,
+                    capabilities,
+                    connectionWatermarks,
+                    queueWatermarks
+                );
+            std::memcpy(newConn->connLocalPublicKey, publicKey, sizeof(publicKey));
+            newConn->connLocalPort = port;
+            if (dispatchMode == DispatchMode::ioThread) {
+                newConn->connDeliver = [this] (MetaPacket<pR>& packet) {
+                    deliver(packet);
+                };
+            }
+            std::scoped_lock lock(createdMutex);
+            if (createdConnections.size() >= createdConnectionsLimit) {
+                std::erase_if(createdConnections, [] (std::weak_ptr<Connection<pR>>& weakConn) { return weakConn.expired(); });
+                createdConnectionsLimit = std::max<size_t>(DEFAULT_MAX_CONNECTIONS, createdConnections.size() * 2);
             }
+            createdConnections.push_back(newConn);
+            return newConn;
+        }
+
+        // maps the peer cache file at 'path', peers connected from now on are remembered in it
+        bool openPeerCache(const std::string& path) {
+            return peerCache.open(path);
         }
 
-        // async - wait for connection
-        void waitForConnection() {
-            asioAcceptor.async_accept(
-                [this] (
+        // async - connects to the peers of the peer cache seen the most recently, at most 'maxCount' of them
+        void reconnectKnownPeers(size_t maxCount = DEFAULT_RECONNECT_PEERS) {
+            std::vector<PeerRecord> peers = peerCache.recent(maxCount);
+            print::debug("reconnectKnownPeers(): reconnecting to " + std::to_string(peers.size()) + " known peers");
+            for (PeerRecord& peer : peers) {
+                assureConnection(peer.publicKey);
+            }
+        }
+
+        // one acceptor for each shard, the kernel balances the incoming connections between them
+        // without port sharing a single acceptor hands out the connections to the shards round robin
+        void openAcceptors(const ip::tcp::endpoint& localEndpoint) {
+#ifdef SO_REUSEPORT
+            size_t acceptorCount = ioPool.size();
+#else
+            size_t acceptorCount = 1;
+#endif
+            for (size_t i = 0; i < acceptorCount; i++) {
+                ip::tcp::acceptor& acceptor = acceptors.emplace_back(ioPool.get(i));
+                acceptor.open(localEndpoint.protocol());
+                acceptor.set_option(ip::tcp::acceptor::reuse_address(true));
+#ifdef SO_REUSEPORT
+                if (acceptorCount > 1) acceptor.set_option(detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>(true));
+#endif
+                acceptor.bind(localEndpoint);
+                acceptor.listen();
+            }
+        }
+
+        // async - wait for connection on an acceptor
+        void waitForConnection(size_t acceptorIndex = 0) {
+            // accepted sockets stay on the shard of their acceptor if every shard has one
+            io_context& shard = acceptors.size() > 1 ? ioPool.get(acceptorIndex) : ioPool.next();
+            acceptors[acceptorIndex].async_accept(
+                shard,
+                [this, acceptorIndex, &shard, alive = lifetime.watch()] (
                     std::error_code ec, 
                     ip::tcp::socket socket
                 ) {
+                    // the acceptor was closed by stop(), the endpoint may be gone already
+                    Lifetime::Guard guard = alive.lock();
+                    if (!guard || stopped) return;
                     if (!ec) {
                         print::debug(std::string("waitForConnection(): new connection from ") 
                             + socket.remote_endpoint().address().to_string());
                         // create new connection to handle client
-                        std::shared_ptr<Connection<pT, pS>> newConn =
-                            std::make_shared<Connection<pT, pS>> (
-                                asioContext, 
-                                std::move(socket), 
-                                packetsIn
-                            );
+                        std::shared_ptr<Connection<pR>> newConn = createConnection(shard, std::move(socket));
                         // TODO: revise onNodeConnect()
                         if (onNodeConnect(newConn)) {
                             // considering remote node as connected and validating the connection
                             newConn->localConnect(
-                                [this, newConn] (
-                                    std::shared_ptr<Connection<pT, pS>> conn
+                                [this] (
+                                    std::shared_ptr<Connection<pR>> conn
                                 ) {
-                                    this->connections.set(
-                                        conn->publicKey,
-                                        conn->connSocket.remote_endpoint().address().to_string(),
-                                        conn->connSocket.remote_endpoint().port(),
-                                        conn->shared_from_this()
-                                    );
+                                    this->addConnection(conn);
                                 },
-                                [this, newConn] (
-                                    std::shared_ptr<Connection<pT, pS>> conn
+                                [this] (
+                                    std::shared_ptr<Connection<pR>> conn
                                 ) {
-                                    this->disconnect(conn->publicKey);
+                                    this->disconnect(conn->publicKey, conn);
                                     //reject(conn);
                                 }
                             );
@@ -151,126 +393,589 @@ template <typename pT, int* pS> class Endpoint : public std::enable_shared_from_
                         print::error(std::string("waitForConnection() - error: ") + ec.message());
                     }
                     // recursively starting to wait for other connections
-                    waitForConnection();
+                    waitForConnection(acceptorIndex);
                 }
             );
         }
 
         // async - makes sure there is a connection with a specified node
+        // 'callback' is only called once the node is connected, concurrent calls for the same node share one connection attempt
         void assureConnection(
             char* _publicKey, 
-            std::function<void(std::shared_ptr<Connection<pT, pS>>)> callback = [](std::shared_ptr<Connection<pT, pS>>){}
+            std::function<void(std::shared_ptr<Connection<pR>>)> callback = [](std::shared_ptr<Connection<pR>>){}
         ) {
-            ConnectionData<pT, pS>* res = connections.get(_publicKey);
-            if (!res) {
-                print::trace("assureConnection(): could not find node in local routing table");
-                queryConnectionData(
-                    _publicKey, 
-                    [this, callback] (ConnectionData<pT, pS> _node) {
-                        this->connect(
-                            _node.ipAddress,
-                            _node.port,
-                            callback
-                        );
-                    }
-                );
-                return;
-            }
-            if (!(res->connection) || !(res->connection->isOpen())) {
-                print::trace("assureConnection(): node found in routing table");
-                connect(
-                    res->ipAddress,
-                    res->port,
-                    callback
-                );
-            } else {
-                print::trace("assureConnection(): node has active connection");
-                callback(res->connection);
-            }
+            requestConnection(_publicKey, std::nullopt, std::move(callback), std::nullopt, nullptr);
         }
 
-        void disconnect(::publicKey _publicKey) {
+        // if 'lost' is set, the node is only disconnected while its entry holds that connection,
+        // so a connection closed late does not take the place of a newer one to the same node
+        void disconnect(::publicKey _publicKey, std::shared_ptr<Connection<pR>> lost = nullptr) {
             print::debug(std::string("disconnect() - disconnecting from ") + std::string(_publicKey));
-            ConnectionData<pT, pS>* node = connections.get(_publicKey);
-            if (!node) {
+            std::optional<ConnectionData<pR>> node = connections.get(_publicKey);
+            if (!node || (lost && node->connection != lost)) {
                 return;
             }
             onNodeDisconnect(node->connection);
-            node->connection.reset();
-            connections.set(
+            peerCache.touch(_publicKey);
+            // the address is kept, so the node can be connected again
+            connections.update(
                 _publicKey,
-                node->ipAddress,
-                node->port
+                [lost] (ConnectionData<pR>& _node) {
+                    if (!lost || _node.connection == lost) _node.connection.reset();
+                }
             );
         }
 
         // async - send a packet to a specified node
-        void sendNode(std::shared_ptr<Connection<pT, pS>> remoteNode, Packet<pT, pS>& _packet) {
+        void sendNode(std::shared_ptr<Connection<pR>> remoteNode, Packet<pR> _packet) {
             if (remoteNode && remoteNode->isOpen()) {
-                remoteNode->send(_packet);
+                remoteNode->send(std::move(_packet));
             }
         }
 
         // async - send a packet to a specified nodes
+        // the packet is owned by the operation, while the node is being connected it waits with the others sent to it,
+        // at most 'maxPendingPackets' of them, and they are sent in order once the connection is validated
         void sendNode(
             char* _publicKey, 
-            Packet<pT, pS>& _packet
+            Packet<pR> _packet
         ) {
-            assureConnection(
-                _publicKey,
-                [this, &_packet] (
-                    std::shared_ptr<Connection<pT, pS>> node
-                ) {
-                    if (!node) {
-                        print::error("sendNode(): got nullptr for connection");
-                        return;
+            requestConnection(_publicKey, std::nullopt, nullptr, std::move(_packet), nullptr);
+        }
+
+        // async - hands the open connection of a node to 'callback' and sends 'packet' over it,
+        // if there is none, they wait for a new connection opened at 'known', or at the address the node is found at
+        // a node being connected is looked for first, so everything waits in order for the attempt under way,
+        // and 'reject' is called if that attempt fails
+        void requestConnection(
+            char* _publicKey,
+            std::optional<ConnectionData<pR>> known,
+            std::function<void(std::shared_ptr<Connection<pR>>)> callback,
+            std::optional<Packet<pR>> packet,
+            std::function<void()> reject
+        ) {
+            NodeKey key(_publicKey);
+            std::shared_ptr<Connection<pR>> open;
+            std::optional<uint64_t> attempt;
+            {
+                std::scoped_lock lock(pendingMutex);
+                if (!pendingConnections.contains(key)) {
+                    std::optional<ConnectionData<pR>> node = connections.get(_publicKey);
+                    if (node && node->connection && node->connection->isOpen()) {
+                        open = node->connection;
+                    } else if (!known) {
+                        known = node;
                     }
-                    node->send(_packet);
+                }
+                if (open) {
+                    print::trace("assureConnection(): node has active connection");
+                    if (packet) open->send(std::move(*packet));
+                } else {
+                    attempt = addPendingConnection(key, std::move(callback), std::move(packet), std::move(reject));
+                }
+            }
+            if (open && callback) callback(open);
+            if (attempt) openConnection(_publicKey, known, *attempt);
+        }
+
+        // waits for the connection of a node with 'callback', 'packet' and 'reject', the caller holds 'pendingMutex'
+        // returns the id of a new attempt if the node is not being connected yet, the caller has to start it then
+        std::optional<uint64_t> addPendingConnection(
+            const NodeKey& key,
+            std::function<void(std::shared_ptr<Connection<pR>>)> callback,
+            std::optional<Packet<pR>> packet,
+            std::function<void()> reject
+        ) {
+            auto [it, isNew] = pendingConnections.try_emplace(key);
+            PendingConnection& pending = it->second;
+            if (isNew) pending.attempt = nextConnectionAttempt++;
+            if (callback) pending.callbacks.push_back(std::move(callback));
+            if (reject) pending.rejects.push_back(std::move(reject));
+            if (packet) {
+                if (pending.packets.size() < maxPendingPackets) {
+                    pending.packets.push_back(std::move(*packet));
+                } else {
+                    print::error(std::string("sendNode() - error: too many packets waiting for ") + key.c_str() + ", packet dropped");
+                }
+            }
+            if (!isNew) print::trace("assureConnection(): node is already being connected");
+            return isNew ? std::optional<uint64_t>(pending.attempt) : std::nullopt;
+        }
+
+        // async - connects the node of a new attempt at its known address, or looks its address up first
+        // a validated connection takes the waiting work in addConnection(), whatever is left once the attempt ends is dropped
+        void openConnection(char* _publicKey, std::optional<ConnectionData<pR>> known, uint64_t attempt) {
+            NodeKey key(_publicKey);
+            auto ended = [this, key, attempt] (std::shared_ptr<Connection<pR>>) {
+                dropPendingConnection(key, attempt);
+            };
+            if (known) {
+                print::trace("assureConnection(): node found in routing table");
+                connect(known->ipAddress, known->port, ended, ended);
+                return;
+            }
+            if (std::optional<PeerRecord> peer = peerCache.get(key)) {
+                print::trace("assureConnection(): node found in peer cache");
+                connect(peer->ipAddress, peer->port, ended, ended);
+                return;
+            }
+            print::trace("assureConnection(): could not find node in local routing table");
+            queryConnectionData(
+                _publicKey, 
+                [this, ended] (ConnectionData<pR> _node) {
+                    this->connect(_node.ipAddress, _node.port, ended, ended);
+                },
+                [ended] () {
+                    ended(nullptr);
                 }
             );
         }
 
+        // the attempt ended without a connection to the node, e.g. it failed or reached another node,
+        // the packets waiting for it are dropped and the rejects are called
+        void dropPendingConnection(const NodeKey& key, uint64_t attempt) {
+            PendingConnection pending;
+            {
+                std::scoped_lock lock(pendingMutex);
+                auto it = pendingConnections.find(key);
+                if (it == pendingConnections.end() || it->second.attempt != attempt) return;
+                pending = std::move(it->second);
+                pendingConnections.erase(it);
+            }
+            if (!pending.packets.empty()) {
+                print::error(std::string("sendNode() - error: could not connect to ") + key.c_str() + ", "
+                    + std::to_string(pending.packets.size()) + " packets dropped");
+            }
+            for (auto& reject : pending.rejects) reject();
+        }
+
         // 'maxPackets' defines how many packets to process at once
-        // if 'wait' is set to true, the thread sleeps until a packet is received
-        void update(uint32_t maxPackets = -1, bool wait = false) {
-            if (wait) packetsIn.wait();
+        // if 'wait' is set to true, the thread sleeps until a packet is received, but at most for 'timeout'
+        // only one thread may call this at a time, so the packets of a sender are dispatched in order
+        void update(
+            uint32_t maxPackets = -1, 
+            bool wait = false, 
+            std::chrono::milliseconds timeout = std::chrono::milliseconds::max()
+        ) {
+            if (wait && !waitForPackets(timeout)) return;
             uint32_t packetCount = 0;
-            while (packetCount < maxPackets && !packetsIn.empty()) {
-                auto _packet = packetsIn.pop_front();
-                onMessage(_packet);
+            MetaPacket<pR> _packet;
+            while (packetCount < maxPackets && packetsIn.try_pop(_packet)) {
+                deliver(_packet);
                 packetCount++;
             }
         }
 
+        // same as update(), but the packets are handed over to 'onMessages' in one batch
+        // in the pool modes the packets are delivered one by one, as a batch would span several senders
+        void updateBatch(
+            uint32_t maxPackets = -1, 
+            bool wait = false, 
+            std::chrono::milliseconds timeout = std::chrono::milliseconds::max()
+        ) {
+            if (wait && !waitForPackets(timeout)) return;
+            packetsIn.drain(packetBatch, maxPackets);
+            if (packetBatch.empty()) return;
+            if (dispatchPool) {
+                for (MetaPacket<pR>& packet : packetBatch) deliver(packet);
+            } else {
+                static_cast<nodeT&>(*this).onMessages(std::span<MetaPacket<pR>>(packetBatch));
+                for (MetaPacket<pR>& packet : packetBatch) finishPacket(packet);
+            }
+            packetBatch.clear();
+        }
+
+        // calls the handler of the packet type through the registry's jump table
+        // on this thread (the caller of update() or an io thread), or on the strand of the sender in the pool modes, where the packet is moved into the task
+        void deliver(MetaPacket<pR>& packet) {
+            if (!dispatchPool) {
+                pR::dispatch(static_cast<nodeT&>(*this), packet);
+                finishPacket(packet);
+                return;
+            }
+            post(
+                dispatchStrand(packet),
+                [this, packet = std::move(packet)] () mutable {
+                    pR::dispatch(static_cast<nodeT&>(*this), packet);
+                    finishPacket(packet);
+                }
+            );
+        }
+
+        // strand keeping the order of the packets of a sender, only called by the consumer thread
+        strand<thread_pool::executor_type>& dispatchStrand(MetaPacket<pR>& packet) {
+            if (dispatchMode == DispatchMode::keyHash || !packet.packetConn) {
+                size_t hash = std::hash<std::string_view>()(std::string_view(packet.senderPublicKey));
+                return dispatchStrands[hash % dispatchStrands.size()];
+            }
+            if (!packet.packetConn->connDispatchStrand) {
+                packet.packetConn->connDispatchStrand.emplace(make_strand(dispatchPool->get_executor()));
+            }
+            return *packet.packetConn->connDispatchStrand;
+        }
+
+        // the dht sends its packets over the connections of the endpoint, opening them if needed
+        void startDHT() {
+            dht.setLocalKey(NodeKey(publicKey));
+            dht.send = [this] (const DHTContact& contact, Packet<pR> packet, std::function<void()> fail) {
+                NodeKey key(contact.publicKey);
+                requestConnection(
+                    key.bytes.data(),
+                    ConnectionData<pR>{ contact.ipAddress, contact.port, nullptr },
+                    nullptr,
+                    std::move(packet),
+                    std::move(fail)
+                );
+            };
+        }
+
+        // async - connects to a node of the network and announces this node to the nodes closest to it
+        // 'callback' gets the number of nodes this node was announced to
+        void joinNetwork(
+            const std::string& host, 
+            uint16_t port, 
+            std::function<void(size_t)> callback = [](size_t){}
+        ) {
+            static_assert(pR::hasDHT, "Joining a network needs the packet types of the dht");
+            // the reject callback stays with the connection after the handshake, it only counts before that
+            auto connected = std::make_shared<std::atomic<bool>>(false);
+            connect(
+                host,
+                port,
+                [this, callback, connected] (std::shared_ptr<Connection<pR>> conn) {
+                    *connected = true;
+                    dht.join(callback);
+                },
+                [callback, connected] (std::shared_ptr<Connection<pR>> conn) {
+                    if (*connected) return;
+                    print::error("joinNetwork() - error: could not connect to the network");
+                    callback(0);
+                }
+            );
+        }
+
+        // the queries of the directory go to the parent node, which is connected again if needed
+        void startDirectory() {
+            if constexpr (pR::hasDirectory) {
+                directory.sendToParent = [this] (Packet<pR> packet, std::function<void()> fail) {
+                    std::optional<ConnectionData<pR>> parent;
+                    {
+                        std::scoped_lock lock(parentMutex);
+                        parent = parentNode;
+                    }
+                    if (!parent) {
+                        fail();
+                        return;
+                    }
+                    if (parent->connection && parent->connection->isOpen()) {
+                        parent->connection->send(std::move(packet));
+                        return;
+                    }
+                    connectParent(
+                        parent->ipAddress,
+                        parent->port,
+                        [packet = std::move(packet), fail] (std::shared_ptr<Connection<pR>> conn) mutable {
+                            if (!conn) {
+                                fail();
+                                return;
+                            }
+                            conn->send(std::move(packet));
+                        }
+                    );
+                };
+            }
+        }
+
+        // async - makes the node at 'host' the parent of this node, this node and its subtree are registered at it
+        // 'callback' gets the connection to the parent, or nullptr if it could not be reached
+        void connectParent(
+            const std::string& host, 
+            uint16_t port, 
+            std::function<void(std::shared_ptr<Connection<pR>>)> callback = [](std::shared_ptr<Connection<pR>>){}
+        ) {
+            static_assert(pR::hasDirectory, "A parent node needs the packet types of the directory");
+            std::optional<NodeKey> knownKey;
+            {
+                std::scoped_lock lock(parentMutex);
+                if (!parentNode) parentNode = ConnectionData<pR>{ host, port, nullptr };
+                if (parentNode->ipAddress == host && parentNode->port == port) knownKey = parentKey;
+            }
+            auto registered = [this, host, port, callback] (std::shared_ptr<Connection<pR>> conn) {
+                {
+                    std::scoped_lock lock(parentMutex);
+                    parentNode = ConnectionData<pR>{ host, port, conn };
+                    parentKey = NodeKey(conn->publicKey);
+                }
+                DirectoryRegisterPayload announcement = {};
+                std::memcpy(announcement.contact.publicKey, publicKey, sizeof(announcement.contact.publicKey));
+                announcement.contact.port = this->port;
+                conn->send(Packet<pR>::template of<typename pR::template spec<pR::type::directoryRegister>>(announcement));
+                callback(conn);
+            };
+            auto unreachable = [callback] () {
+                print::error("connectParent() - error: could not connect to the parent node");
+                callback(nullptr);
+            };
+            // a parent connected before is connected again like any other node, sharing the attempt with the work waiting for it,
+            // the public key of a new parent is only known after the handshake, so it is connected directly
+            if (knownKey) {
+                requestConnection(knownKey->bytes.data(), ConnectionData<pR>{ host, port, nullptr }, registered, std::nullopt, unreachable);
+                return;
+            }
+            // the reject callback stays with the connection after the handshake, it only counts before that
+            auto connected = std::make_shared<std::atomic<bool>>(false);
+            connect(
+                host,
+                port,
+                [registered, connected] (std::shared_ptr<Connection<pR>> conn) {
+                    *connected = true;
+                    registered(conn);
+                },
+                [unreachable, connected] (std::shared_ptr<Connection<pR>> conn) {
+                    if (*connected) return;
+                    unreachable();
+                }
+            );
+        }
+
+        bool hasParent() {
+            std::scoped_lock lock(parentMutex);
+            return parentNode.has_value();
+        }
+
+        // whether the packet came from the parent node
+        bool isFromParent(MetaPacket<pR>& packet) {
+            std::scoped_lock lock(parentMutex);
+            return parentNode && parentNode->connection == packet.packetConn;
+        }
+
+        void startDispatchPool() {
+            dispatchPool = std::make_unique<thread_pool>(dispatchThreads);
+            for (size_t i = 0; i < DEFAULT_DISPATCH_SHARDS; i++) {
+                dispatchStrands.push_back(make_strand(dispatchPool->get_executor()));
+            }
+            print::debug(std::string("startDispatchPool(): handlers run on ") + std::to_string(dispatchThreads) + std::string(" threads"));
+        }
+
+        // handlers are done with the packet, its body can be reused
+        // and its connection may resume reading if it was held back
+        void finishPacket(MetaPacket<pR>& packet) {
+            bufferPool.release(std::move(packet.content.body));
+            if (packet.packetConn) {
+                packet.packetConn->packetProcessed();
+                packet.packetConn.reset();
+            }
+        }
+
+        // returns false if no packet arrived within 'timeout'
+        bool waitForPackets(std::chrono::milliseconds timeout) {
+            if (timeout == std::chrono::milliseconds::max()) {
+                packetsIn.wait();
+                return true;
+            }
+            return packetsIn.wait_for(timeout);
+        }
+
+        // event handler - batch of incoming packets, dispatches them one by one unless the node overrides it
+        void onMessages(std::span<MetaPacket<pR>> packets) {
+            for (MetaPacket<pR>& packet : packets) {
+                pR::dispatch(static_cast<nodeT&>(*this), packet);
+            }
+        }
+
         // event handler - incoming connection (returning false means dropping connection)
-        virtual bool onNodeConnect(std::shared_ptr<Connection<pT, pS>> remoteNode) {
+        virtual bool onNodeConnect(std::shared_ptr<Connection<pR>> remoteNode) {
             return true;
         }
 
         // event handler - disconnection of remote node
-        virtual void onNodeDisconnect(std::shared_ptr<Connection<pT, pS>> remoteNode) { }
-
-        // event handler - incoming packet
-        virtual void onMessage(MetaPacket<pT, pS>& packet) {
-            print::info("onMessage(): incoming packet");
-            // handler for each packet type
-            switch (packet.content.header.packetType) {
-                case pT::textMessage: {
-                    char s[256];
-                    packet.content >> s;
-                    std::cout << s << std::endl;
-                    break;
+        virtual void onNodeDisconnect(std::shared_ptr<Connection<pR>> remoteNode) { }
+
+        // event handler - incoming packet of a type the node has no 'onMessage(spec, packet)' handler for
+        void onUnhandled(MetaPacket<pR>& packet) {
+            print::error("onUnhandled() - error: no handler for packet type " 
+                + std::to_string(int(packet.content.header.packetType)));
+        }
+
+        // event handler - a node looks for the contacts closest to a public key
+        template <typename specT> requires std::is_same_v<typename specT::payload, DHTFindNodePayload>
+        void onProtocolMessage(specT, MetaPacket<pR>& packet) {
+            DHTFindNodePayload request;
+            PacketReader<pR> reader(packet.content);
+            reader >> request;
+            if (!reader.ok() || !packet.packetConn) return;
+            request.target[sizeof(request.target) - 1] = '\0';
+            // the address of a node is known if it is in the routing table
+            std::optional<DHTContact> exact;
+            if (std::optional<ConnectionData<pR>> node = connections.get(request.target); node && node->port) {
+                exact = contactOf(request.target, *node);
+            }
+            packet.packetConn->send(Packet<pR>::template of<typename pR::template spec<pR::type::dhtNodes>>(dht.answer(request, exact)));
+        }
+
+        // event handler - answer to a lookup of this node
+        template <typename specT> requires std::is_same_v<typename specT::payload, DHTNodesPayload>
+        void onProtocolMessage(specT, MetaPacket<pR>& packet) {
+            DHTNodesPayload reply;
+            PacketReader<pR> reader(packet.content);
+            reader >> reply;
+            if (!reader.ok()) return;
+            dht.onNodes(reply, NodeKey(packet.senderPublicKey));
+        }
+
+        // event handler - a node announces its address, which is taken from its connection
+        template <typename specT> requires std::is_same_v<typename specT::payload, DHTStorePayload>
+        void onProtocolMessage(specT, MetaPacket<pR>& packet) {
+            DHTStorePayload store;
+            PacketReader<pR> reader(packet.content);
+            reader >> store;
+            if (!reader.ok() || !packet.packetConn) return;
+            store.contact.publicKey[sizeof(store.contact.publicKey) - 1] = '\0';
+            // only the node itself may announce its address
+            if (NodeKey(store.contact.publicKey) != NodeKey(packet.senderPublicKey)) return;
+            if (!connections.get(store.contact.publicKey)) {
+                boost::system::error_code ec;
+                ip::tcp::endpoint remoteEndpoint = packet.packetConn->connSocket.remote_endpoint(ec);
+                if (ec) return;
+                connections.set(store.contact.publicKey, remoteEndpoint.address().to_string(), packet.packetConn->connRemotePort);
+            }
+        }
+
+        // event handler - a child node looks for the address of a node
+        // answered from the routing table, or from the parent of this node if it has one
+        template <typename specT> requires std::is_same_v<typename specT::payload, DirectoryQueryPayload>
+        void onProtocolMessage(specT, MetaPacket<pR>& packet) {
+            DirectoryQueryPayload request;
+            PacketReader<pR> reader(packet.content);
+            reader >> request;
+            if (!reader.ok() || !packet.packetConn) return;
+            request.target[sizeof(request.target) - 1] = '\0';
+            auto answer = [conn = packet.packetConn, request] (std::optional<DHTContact> contact) {
+                DirectoryAnswerPayload reply = {};
+                reply.queryId = request.queryId;
+                std::memcpy(reply.target, request.target, sizeof(reply.target));
+                if (contact) {
+                    reply.found = 1;
+                    reply.contact = *contact;
                 }
-                // default case always means programming error
-                default: {
-                    std::cout << "onMessage() - error: this message should not have got to this handler" << std::endl;
-                    break;
+                conn->send(Packet<pR>::template of<typename pR::template spec<pR::type::directoryAnswer>>(reply));
+            };
+            if (std::optional<ConnectionData<pR>> node = connections.get(request.target); node && node->port) {
+                answer(contactOf(request.target, *node));
+            } else if (hasParent() && !isFromParent(packet)) {
+                directory.lookup(NodeKey(request.target), answer);
+            } else {
+                answer(std::nullopt);
+            }
+        }
+
+        // event handler - answer of the parent node, answers of other nodes are dropped
+        template <typename specT> requires std::is_same_v<typename specT::payload, DirectoryAnswerPayload>
+        void onProtocolMessage(specT, MetaPacket<pR>& packet) {
+            DirectoryAnswerPayload answer;
+            PacketReader<pR> reader(packet.content);
+            reader >> answer;
+            if (!reader.ok() || !isFromParent(packet)) return;
+            directory.onAnswer(answer);
+        }
+
+        // event handler - a node of the subtree announces its address, which is passed on to the parent
+        // a node may register itself, at the address of its connection, the nodes below a child are only taken from that child
+        // once it registered itself, and a child can not take over a node registered by another one
+        template <typename specT> requires std::is_same_v<typename specT::payload, DirectoryRegisterPayload>
+        void onProtocolMessage(specT, MetaPacket<pR>& packet) {
+            DirectoryRegisterPayload announcement;
+            PacketReader<pR> reader(packet.content);
+            reader >> announcement;
+            if (!reader.ok() || !packet.packetConn || isFromParent(packet)) return;
+            DHTContact& contact = announcement.contact;
+            contact.publicKey[sizeof(contact.publicKey) - 1] = '\0';
+            contact.ipAddress[sizeof(contact.ipAddress) - 1] = '\0';
+            NodeKey target(contact.publicKey);
+            NodeKey sender(packet.senderPublicKey);
+            if (target == sender) {
+                boost::system::error_code ec;
+                ip::tcp::endpoint remoteEndpoint = packet.packetConn->connSocket.remote_endpoint(ec);
+                if (ec) return;
+                std::memset(contact.ipAddress, 0, sizeof(contact.ipAddress));
+                std::strncpy(contact.ipAddress, remoteEndpoint.address().to_string().c_str(), sizeof(contact.ipAddress) - 1);
+            } else if (contact.ipAddress[0] == '\0') {
+                return;
+            }
+            {
+                std::scoped_lock lock(registryMutex);
+                if (target != sender) {
+                    auto child = registeredBy.find(sender);
+                    if (child == registeredBy.end() || child->second != sender) {
+                        print::debug(std::string("directoryRegister: ") + sender.c_str() + " is not a child, record dropped");
+                        return;
+                    }
+                    auto registered = registeredBy.find(target);
+                    if (registered != registeredBy.end() && registered->second != sender) {
+                        print::debug(std::string("directoryRegister: ") + target.c_str() + " belongs to another child, record dropped");
+                        return;
+                    }
                 }
+                registeredBy[target] = sender;
+            }
+            // the record is the latest word of the child the node belongs to, a connection to it is kept
+            std::string ipAddress(contact.ipAddress);
+            uint16_t port = contact.port;
+            if (!connections.update(contact.publicKey, [&ipAddress, port] (ConnectionData<pR>& node) {
+                node.ipAddress = ipAddress;
+                node.port = port;
+            })) {
+                connections.set(contact.publicKey, ipAddress, port);
             }
+            std::optional<ConnectionData<pR>> parent;
+            {
+                std::scoped_lock lock(parentMutex);
+                parent = parentNode;
+            }
+            if (parent && parent->connection && parent->connection->isOpen()) {
+                parent->connection->send(Packet<pR>::template of<typename pR::template spec<pR::type::directoryRegister>>(announcement));
+            }
+        }
+
+        // contact of a node of the routing table, as it is sent in the packets of the dht and the directory
+        static DHTContact contactOf(const char* _publicKey, const ConnectionData<pR>& node) {
+            DHTContact contact = {};
+            std::memcpy(contact.publicKey, _publicKey, strnlen(_publicKey, sizeof(contact.publicKey) - 1));
+            std::strncpy(contact.ipAddress, node.ipAddress.c_str(), sizeof(contact.ipAddress) - 1);
+            contact.port = node.port;
+            return contact;
         }
 
+        // async - resolves the address of a node missing from the routing table
+        // through the parent node if there is one, otherwise through the dht
+        // 'reject' is called instead of 'callback' if the node could not be found
         virtual void queryConnectionData(
             char* _publicKey, 
-            std::function<void(ConnectionData<pT, pS>)> callback = [](ConnectionData<pT, pS>){}
-        ) { }
+            std::function<void(ConnectionData<pR>)> callback = [](ConnectionData<pR>){},
+            std::function<void()> reject = [](){}
+        ) {
+            std::string key(_publicKey);
+            auto resolved = [callback, reject, key] (std::optional<DHTContact> contact) {
+                if (!contact) {
+                    print::error(std::string("queryConnectionData() - error: could not find node ") + key);
+                    reject();
+                    return;
+                }
+                ConnectionData<pR> node;
+                node.ipAddress = contact->ipAddress;
+                node.port = contact->port;
+                callback(node);
+            };
+            if constexpr (pR::hasDirectory) {
+                if (hasParent()) {
+                    directory.lookup(NodeKey(_publicKey), resolved);
+                    return;
+                }
+            }
+            if constexpr (pR::hasDHT) {
+                dht.lookup(NodeKey(_publicKey), resolved);
+            } else {
+                reject();
+            }
+        }
 };
\ No newline at end of file
@@ -0,0 +1,100 @@
+// Copyright (c) 2022 Dániel Gergely, Dénes Balogh
+// Distributed under the MIT License.
+
+#pragma once
+#include "common.hpp"
+
+// recycles the memory asio allocates for the completion handlers of a connection
+// handlers may be allocated on one thread and freed on another (posted sends), so the free lists are locked
+class HandlerMemory {
+    private:
+        // blocks are sized in multiples of this, larger requests go to the heap
+        static constexpr size_t blockSize = 64;
+        static constexpr size_t classCount = 16;
+        // blocks kept per size class, enough for the sends posted by a fast sender
+        static constexpr size_t maxCachedBlocks = 1 << 14;
+
+        std::mutex containerMutex;
+        std::array<std::vector<void*>, classCount> freeBlocks;
+
+    public:
+        HandlerMemory() = default;
+        HandlerMemory(const HandlerMemory&) = delete;
+        virtual ~HandlerMemory() {
+            for (std::vector<void*>& blocks : freeBlocks) {
+                for (void* block : blocks) ::operator delete(block);
+            }
+        }
+
+        void* allocate(size_t size) {
+            size_t sizeClass = (size + blockSize - 1) / blockSize - 1;
+            if (size == 0 || sizeClass >= classCount) return ::operator new(size);
+            {
+                std::scoped_lock lock(containerMutex);
+                if (!freeBlocks[sizeClass].empty()) {
+                    void* block = freeBlocks[sizeClass].back();
+                    freeBlocks[sizeClass].pop_back();
+                    return block;
+                }
+            }
+            return ::operator new((sizeClass + 1) * blockSize);
+        }
+
+        void deallocate(void* block, size_t size) {
+            size_t sizeClass = (size + blockSize - 1) / blockSize - 1;
+            if (size > 0 && sizeClass < classCount) {
+                std::scoped_lock lock(containerMutex);
+                if (freeBlocks[sizeClass].size() < maxCachedBlocks) {
+                    freeBlocks[sizeClass].push_back(block);
+                    return;
+                }
+            }
+            ::operator delete(block);
+        }
+};
+
+// standard allocator over the handler memory of a connection, asio finds it through associated_allocator
+template <typename T> class HandlerAllocator {
+    public:
+        using value_type = T;
+
+        HandlerMemory* memory;
+
+        explicit HandlerAllocator(HandlerMemory& _memory) noexcept : memory(&_memory) {}
+        template <typename U> HandlerAllocator(const HandlerAllocator<U>& other) noexcept : memory(other.memory) {}
+
+        T* allocate(size_t n) {
+            return static_cast<T*>(memory->allocate(n * sizeof(T)));
+        }
+
+        void deallocate(T* p, size_t n) {
+            memory->deallocate(p, n * sizeof(T));
+        }
+
+        template <typename U> bool operator == (const HandlerAllocator<U>& other) const noexcept {
+            return memory == other.memory;
+        }
+};
+
+// a completion handler allocated from handler memory, the handler itself is stored by value
+template <typename handlerT> class AllocatingHandler {
+    public:
+        using allocator_type = HandlerAllocator<handlerT>;
+
+        HandlerMemory& memory;
+        handlerT handler;
+
+        AllocatingHandler(HandlerMemory& _memory, handlerT&& _handler) : memory(_memory), handler(std::move(_handler)) {}
+
+        allocator_type get_allocator() const noexcept {
+            return allocator_type(memory);
+        }
+
+        template <typename... argTs> void operator () (argTs&&... args) {
+            handler(std::forward<argTs>(args)...);
+        }
+};
+
+template <typename handlerT> AllocatingHandler<std::decay_t<handlerT>> withMemory(HandlerMemory& memory, handlerT&& handler) {
+    return AllocatingHandler<std::decay_t<handlerT>>(memory, std::forward<handlerT>(handler));
+}
@@ -0,0 +1,90 @@
+// Copyright (c) 2022 Dániel Gergely, Dénes Balogh
+// Distributed under the MIT License.
+
+#pragma once
+#include "common.hpp"
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// a fixed number of io_contexts, each run by its own thread
+// a connection is bound to one shard for its whole life, so its handlers never run concurrently
+// and the shards do not share any state of asio
+// an external context is a single shard run by its owner, the pool neither starts nor stops it
+class IOContextPool {
+    private:
+        std::vector<io_context*> contexts;
+        std::vector<std::unique_ptr<io_context>> ownedContexts;
+        // keeps the contexts running while they have no work
+        std::vector<executor_work_guard<io_context::executor_type>> workGuards;
+        std::vector<std::thread> threads;
+        // shard of the next connection
+        std::atomic<size_t> nextContext = 0;
+
+    public:
+        IOContextPool(size_t size = 1) {
+            if (size == 0) size = 1;
+            for (size_t i = 0; i < size; i++) {
+                contexts.push_back(ownedContexts.emplace_back(std::make_unique<io_context>(1)).get());
+            }
+        }
+        IOContextPool(io_context& externalContext) : contexts{ &externalContext } {}
+        IOContextPool(const IOContextPool&) = delete;
+        virtual ~IOContextPool() { stop(); }
+
+        // launches one thread for each context
+        // with 'pinThreads' set, the thread of shard i is pinned to cpu i (modulo the cpu count)
+        void start(bool pinThreads = false) {
+            for (size_t i = 0; i < ownedContexts.size(); i++) {
+                workGuards.push_back(make_work_guard(*ownedContexts[i]));
+                threads.emplace_back(
+                    [this, i] () {
+                        ownedContexts[i]->run();
+                    }
+                );
+                if (pinThreads) pin(threads.back(), i);
+            }
+        }
+
+        void stop() {
+            workGuards.clear();
+            for (std::unique_ptr<io_context>& context : ownedContexts) context->stop();
+            for (std::thread& thread : threads) {
+                if (thread.joinable()) thread.join();
+            }
+            threads.clear();
+        }
+
+        bool isExternal() const {
+            return ownedContexts.empty();
+        }
+
+        size_t size() const {
+            return contexts.size();
+        }
+
+        io_context& get(size_t shard) {
+            return *contexts[shard % contexts.size()];
+        }
+
+        // shards are handed out round robin
+        io_context& next() {
+            return get(nextContext++);
+        }
+
+    private:
+        static void pin(std::thread& thread, size_t shard) {
+#ifdef __linux__
+            cpu_set_t cpuSet;
+            CPU_ZERO(&cpuSet);
+            CPU_SET(shard % std::max(1u, std::thread::hardware_concurrency()), &cpuSet);
+            if (pthread_setaffinity_np(thread.native_handle(), sizeof(cpu_set_t), &cpuSet) != 0) {
+                print::error("IOContextPool::pin() - error: could not pin io thread " + std::to_string(shard));
+            }
+#else
+            print::debug("IOContextPool::pin(): thread pinning is not supported on this platform");
+#endif
+        }
+};
@@ -0,0 +1,32 @@
+// Copyright (c) 2022 Dániel Gergely, Dénes Balogh
+// Distributed under the MIT License.
+
+#pragma once
+#include "common.hpp"
+
+// lets the asynchronous handlers of an object find out whether the object still exists
+// a handler captures watch() and holds the guard it locks from it while it uses the object,
+// ending the lifetime turns the later handlers away and waits for the running ones,
+// so the object must not be destroyed from one of its own guarded handlers
+class Lifetime {
+    private:
+        std::shared_ptr<char> token = std::make_shared<char>();
+
+    public:
+        typedef std::weak_ptr<char> Watch;
+        typedef std::shared_ptr<char> Guard;
+
+        Lifetime() = default;
+        Lifetime(const Lifetime&) = delete;
+        ~Lifetime() { end(); }
+
+        Watch watch() const {
+            return token;
+        }
+
+        void end() {
+            Watch watched = token;
+            token.reset();
+            while (!watched.expired()) std::this_thread::yield();
+        }
+};
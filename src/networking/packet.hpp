@@ -4,19 +4,75 @@
 #pragma once
 #include "common.hpp"
 
-template <typename pT, int* pS> struct PacketHeader {
-    // packet type defines how to parse packet body
+// bits of the flag field of the packet header
+namespace packetFlags {
+    // the body is compressed, see compression.hpp for its format
+    const uint32_t compressed = 1 << 0;
+    // the frame carries a part of a body, the parts of a body follow each other in order within its lane
+    const uint32_t fragment = 1 << 1;
+    // the frame carries the last part of a body
+    const uint32_t finalFragment = 1 << 2;
+}
+
+template <typename pR> struct PacketHeader {
+    using pT = typename pR::type;
+    static_assert(sizeof(pT) == 1, "packet types are a single byte on the wire, declare them as 'enum class pT : uint8_t'");
+
+    // packet type defines how to parse packet body, a single byte, so it has no byte order
     pT packetType;
+    // keeps the header the same size and layout on every platform, always zero
+    uint8_t reserved[3] = {};
+    // length of the body in bytes, always stored in network byte order (big-endian)
+    uint32_t size = 0;
+    // combination of packetFlags, also stored in network byte order
+    uint32_t flags = 0;
+
     // receiver has to reserve enough space to read the body
     size_t bodySize() const { 
-        return pS[int(packetType)]; 
+        return boost::endian::big_to_native(size); 
     };
+
+    void setBodySize(size_t _size) {
+        size = boost::endian::native_to_big(uint32_t(_size));
+    }
+
+    bool hasFlag(uint32_t flag) const {
+        return boost::endian::big_to_native(flags) & flag;
+    }
+
+    void setFlag(uint32_t flag, bool value = true) {
+        uint32_t _flags = boost::endian::big_to_native(flags);
+        flags = boost::endian::native_to_big(value ? (_flags | flag) : (_flags & ~flag));
+    }
+
+    // the type is known by the registry and the body fits the bounds of the type
+    bool isValid() const {
+        return pR::isValid(packetType, bodySize());
+    }
 };
 
-template <typename pT, int* pS> struct Packet {
-    PacketHeader<pT, pS> header;
+template <typename pR> class PacketWriter;
+
+template <typename pR> struct Packet {
+    PacketHeader<pR> header;
     std::vector<uint8_t> body;
 
+    // creates a packet of a registered type with a fixed size payload
+    template <typename specT> static Packet of(const typename specT::payload& payload) {
+        static_assert(
+            std::is_same<specT, typename pR::template spec<specT::type>>::value,
+            "Packet type is not registered with this spec"
+        );
+        static_assert(
+            sizeof(payload) >= specT::minSize && sizeof(payload) <= specT::maxSize,
+            "Payload does not fit the size bounds of the packet type"
+        );
+        Packet packet;
+        packet.header.packetType = specT::type;
+        PacketWriter<pR>(packet, sizeof(payload)) << payload;
+        return packet;
+    }
+
     // stream compatibility
     friend std::ostream& operator << (std::ostream& stream, Packet& packet) {
         stream << "type: " << int(packet.header.packetType) << " size: " << packet.header.bodySize();
@@ -48,16 +104,99 @@ template <typename pT, int* pS> struct Packet {
     }
 };
 
-template <typename pT, int* pS> class Connection;
+// appends fields to the back of a packet body in order
+// space is reserved once up front, so pushing fields does not reallocate the body
+template <typename pR> class PacketWriter {
+    private:
+        Packet<pR>& packet;
+
+    public:
+        PacketWriter(Packet<pR>& _packet, size_t reserveSize = 0) : packet(_packet) {
+            packet.body.reserve(packet.body.size() + reserveSize);
+        }
+
+        // appends a fixed size field
+        template<typename dataT> PacketWriter& operator << (const dataT& data) {
+            static_assert(std::is_trivially_copyable<dataT>::value, "Data is too complex to be written into packet");
+            return write(&data, sizeof(dataT));
+        }
+
+        // appends a variable length byte sequence
+        PacketWriter& write(const void* data, size_t size) {
+            const uint8_t* bytes = static_cast<const uint8_t*>(data);
+            packet.body.insert(packet.body.end(), bytes, bytes + size);
+            return *this;
+        }
+
+        PacketWriter& write(std::string_view text) {
+            return write(text.data(), text.size());
+        }
+
+        size_t size() const {
+            return packet.body.size();
+        }
+};
+
+// reads fields of a packet body in the order they were written
+// the packet is left untouched, so it can still be forwarded after inspection
+template <typename pR> class PacketReader {
+    private:
+        std::span<const uint8_t> body;
+        size_t offset = 0;
+        // set when a read would have run past the end of the body
+        bool failed = false;
+
+    public:
+        PacketReader(const Packet<pR>& _packet) : body(_packet.body) {}
+
+        // copies a fixed size field out of the body
+        template<typename dataT> PacketReader& operator >> (dataT& data) {
+            static_assert(std::is_trivially_copyable<dataT>::value, "Data is too complex to be read from packet");
+            std::span<const uint8_t> bytes = read(sizeof(dataT));
+            if (!bytes.empty()) std::memcpy(&data, bytes.data(), sizeof(dataT));
+            return *this;
+        }
+
+        // returns a view of the next 'size' bytes without copying them
+        std::span<const uint8_t> read(size_t size) {
+            if (failed || size > remaining()) {
+                failed = true;
+                return {};
+            }
+            std::span<const uint8_t> bytes = body.subspan(offset, size);
+            offset += size;
+            return bytes;
+        }
+
+        std::string_view readText(size_t size) {
+            std::span<const uint8_t> bytes = read(size);
+            return std::string_view(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+        }
+
+        // returns a view of the rest of the body
+        std::string_view readText() {
+            return readText(remaining());
+        }
+
+        size_t remaining() const {
+            return body.size() - offset;
+        }
+
+        bool ok() const {
+            return !failed;
+        }
+};
+
+template <typename pR> class Connection;
 
 // a packet with sender data attached for inner processing
-template <typename pT, int* pS> struct MetaPacket {
+template <typename pR> struct MetaPacket {
     // pointer to the connection where the packet is from
-    std::shared_ptr<Connection<pT, pS>> packetConn = nullptr;
+    std::shared_ptr<Connection<pR>> packetConn = nullptr;
     // public key of the sender node
-    char senderPublicKey[5];
+    char senderPublicKey[5] = {};
     // the original packet
-    Packet<pT, pS> content;
+    Packet<pR> content;
 
     // operator override to be compatible with std::cout
     friend std::ostream& operator << (std::ostream& stream, MetaPacket& metaPacket) {
@@ -0,0 +1,248 @@
+// Copyright (c) 2022 Dániel Gergely, Dénes Balogh
+// Distributed under the MIT License.
+
+#pragma once
+#include "common.hpp"
+
+#include <filesystem>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+// a known peer as it is stored in the peer cache file, integers are big-endian and unaligned
+struct PeerRecord {
+    // empty if the slot is unused
+    char publicKey[5];
+    char ipAddress[46];
+    boost::endian::big_uint16_t port;
+    // unix time in seconds
+    boost::endian::big_int64_t lastSeen;
+    // round trip time estimates in microseconds, the way tcp computes them (rfc 6298)
+    boost::endian::big_uint32_t smoothedRTT;
+    boost::endian::big_uint32_t rttVariation;
+    boost::endian::big_uint32_t rttSamples;
+};
+
+struct PeerCacheHeader {
+    char magic[4];
+    boost::endian::big_uint32_t version;
+    // number of record slots, always a power of two
+    boost::endian::big_uint32_t capacity;
+    boost::endian::big_uint32_t count;
+};
+
+// the peers a node has been connected to, kept in a memory-mapped file, so they survive restarts
+// the file is a hash table of fixed-size records, a lookup only touches the pages of its own slots,
+// so startup only counts the used slots to check the file, and every change is a write to the mapped memory of one record
+class PeerCache {
+    private:
+        static constexpr char magic[4] = { 'A', 'X', 'P', 'C' };
+        static constexpr uint32_t version = 1;
+
+        std::mutex containerMutex;
+        std::string path;
+        boost::interprocess::mapped_region region;
+        PeerCacheHeader* header = nullptr;
+        PeerRecord* records = nullptr;
+
+    public:
+        PeerCache() = default;
+        PeerCache(const PeerCache&) = delete;
+        virtual ~PeerCache() { flush(); }
+
+        // maps the file at '_path', creating it if needed
+        // returns false if the file can not be used, the cache stays closed then
+        bool open(const std::string& _path, size_t initialCapacity = DEFAULT_PEER_CACHE_CAPACITY) {
+            std::scoped_lock lock(containerMutex);
+            path = _path;
+            try {
+                if (!std::filesystem::exists(path) || std::filesystem::file_size(path) < sizeof(PeerCacheHeader)) {
+                    create(std::bit_ceil(std::max<size_t>(initialCapacity, 16)));
+                } else {
+                    map();
+                    if (std::memcmp(header->magic, magic, sizeof(magic)) || header->version != version
+                        || !std::has_single_bit(uint32_t(header->capacity))
+                        || region.get_size() < fileSize(header->capacity)
+                        || header->count >= header->capacity || header->count != usedSlots()) {
+                        print::error("PeerCache::open() - error: " + path + " is not a valid peer cache, it is recreated");
+                        create(std::bit_ceil(std::max<size_t>(initialCapacity, 16)));
+                    }
+                }
+            } catch (std::exception& e) {
+                print::error(std::string("PeerCache::open() - error: ") + e.what());
+                header = nullptr;
+                records = nullptr;
+                return false;
+            }
+            print::debug("PeerCache::open(): " + std::to_string(header->count) + " known peers in " + path);
+            return true;
+        }
+
+        bool isOpen() {
+            std::scoped_lock lock(containerMutex);
+            return header;
+        }
+
+        size_t count() {
+            std::scoped_lock lock(containerMutex);
+            return header ? size_t(header->count) : 0;
+        }
+
+        // the peer was connected at 'ipAddress', 'rtt' is a new round trip time sample if it is positive
+        void seen(
+            const NodeKey& key,
+            const std::string& _ipAddress,
+            uint16_t _port,
+            std::chrono::microseconds rtt = std::chrono::microseconds(0)
+        ) {
+            std::scoped_lock lock(containerMutex);
+            if (!header || key.c_str()[0] == '\0') return;
+            PeerRecord* record = find(key);
+            if (!record) {
+                if ((size_t(header->count) + 1) * 4 > size_t(header->capacity) * 3 && !grow()) return;
+                record = insert(key);
+                if (!record) return;
+            }
+            std::memset(record->ipAddress, 0, sizeof(record->ipAddress));
+            std::strncpy(record->ipAddress, _ipAddress.c_str(), sizeof(record->ipAddress) - 1);
+            record->port = _port;
+            record->lastSeen = now();
+            if (rtt.count() > 0) addRTTSample(*record, uint32_t(std::min<int64_t>(rtt.count(), UINT32_MAX)));
+        }
+
+        // the peer was still alive now
+        void touch(const NodeKey& key) {
+            std::scoped_lock lock(containerMutex);
+            if (!header) return;
+            if (PeerRecord* record = find(key)) record->lastSeen = now();
+        }
+
+        std::optional<PeerRecord> get(const NodeKey& key) {
+            std::scoped_lock lock(containerMutex);
+            if (!header) return std::nullopt;
+            PeerRecord* record = find(key);
+            if (!record) return std::nullopt;
+            return terminated(*record);
+        }
+
+        // at most 'maxCount' peers, the most recently seen first
+        std::vector<PeerRecord> recent(size_t maxCount) {
+            std::scoped_lock lock(containerMutex);
+            std::vector<PeerRecord> peers;
+            if (!header) return peers;
+            for (size_t i = 0; i < header->capacity; i++) {
+                if (records[i].publicKey[0] != '\0') peers.push_back(terminated(records[i]));
+            }
+            size_t resultCount = std::min(maxCount, peers.size());
+            std::partial_sort(peers.begin(), peers.begin() + resultCount, peers.end(), [] (const PeerRecord& a, const PeerRecord& b) {
+                return a.lastSeen > b.lastSeen;
+            });
+            peers.resize(resultCount);
+            return peers;
+        }
+
+        // asks the kernel to write the changed pages to the file, without waiting for it
+        void flush() {
+            std::scoped_lock lock(containerMutex);
+            if (header) region.flush(0, 0, true);
+        }
+
+    private:
+        static size_t fileSize(size_t capacity) {
+            return sizeof(PeerCacheHeader) + capacity * sizeof(PeerRecord);
+        }
+
+        static int64_t now() {
+            return std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+        }
+
+        void map() {
+            boost::interprocess::file_mapping file(path.c_str(), boost::interprocess::read_write);
+            region = boost::interprocess::mapped_region(file, boost::interprocess::read_write);
+            header = static_cast<PeerCacheHeader*>(region.get_address());
+            records = reinterpret_cast<PeerRecord*>(header + 1);
+        }
+
+        // an empty cache with 'capacity' slots, the records of the previous file are lost
+        void create(size_t capacity) {
+            region = boost::interprocess::mapped_region();
+            { std::ofstream file(path, std::ios::binary | std::ios::trunc); }
+            std::filesystem::resize_file(path, fileSize(capacity));
+            map();
+            std::memcpy(header->magic, magic, sizeof(magic));
+            header->version = version;
+            header->capacity = uint32_t(capacity);
+            header->count = 0;
+        }
+
+        // the file may have been changed by something else, so the strings of its records are cut at their last byte
+        static PeerRecord terminated(PeerRecord record) {
+            record.publicKey[sizeof(record.publicKey) - 1] = '\0';
+            record.ipAddress[sizeof(record.ipAddress) - 1] = '\0';
+            return record;
+        }
+
+        size_t usedSlots() {
+            size_t used = 0;
+            for (size_t i = 0; i < header->capacity; i++) used += records[i].publicKey[0] != '\0';
+            return used;
+        }
+
+        // probing stops after visiting every slot once, so a full table can not loop forever
+        PeerRecord* find(const NodeKey& key) {
+            size_t mask = header->capacity - 1;
+            size_t i = key.hash() & mask;
+            for (size_t probes = 0; probes < header->capacity && records[i].publicKey[0] != '\0'; probes++, i = (i + 1) & mask) {
+                if (NodeKey(records[i].publicKey) == key) return &records[i];
+            }
+            return nullptr;
+        }
+
+        // returns nullptr if there is no free slot
+        PeerRecord* insert(const NodeKey& key) {
+            size_t mask = header->capacity - 1;
+            size_t i = key.hash() & mask;
+            for (size_t probes = 0; records[i].publicKey[0] != '\0'; probes++, i = (i + 1) & mask) {
+                if (probes == header->capacity) return nullptr;
+            }
+            std::memset(&records[i], 0, sizeof(PeerRecord));
+            std::memcpy(records[i].publicKey, key.c_str(), sizeof(records[i].publicKey));
+            header->count = header->count + 1;
+            return &records[i];
+        }
+
+        // doubles the slots of the file, the records are rehashed into them
+        bool grow() {
+            std::vector<PeerRecord> kept;
+            for (size_t i = 0; i < header->capacity; i++) {
+                if (records[i].publicKey[0] != '\0') kept.push_back(records[i]);
+            }
+            size_t capacity = size_t(header->capacity) * 2;
+            try {
+                region = boost::interprocess::mapped_region();
+                std::filesystem::resize_file(path, fileSize(capacity));
+                map();
+            } catch (std::exception& e) {
+                print::error(std::string("PeerCache::grow() - error: ") + e.what());
+                header = nullptr;
+                records = nullptr;
+                return false;
+            }
+            header->capacity = uint32_t(capacity);
+            header->count = 0;
+            std::memset(records, 0, capacity * sizeof(PeerRecord));
+            for (PeerRecord& record : kept) *insert(NodeKey(record.publicKey)) = record;
+            return true;
+        }
+
+        void addRTTSample(PeerRecord& record, uint32_t rtt) {
+            if (record.rttSamples == 0) {
+                record.smoothedRTT = rtt;
+                record.rttVariation = rtt / 2;
+            } else {
+                int64_t smoothed = record.smoothedRTT;
+                record.rttVariation = uint32_t((3 * int64_t(record.rttVariation) + std::abs(smoothed - int64_t(rtt))) / 4);
+                record.smoothedRTT = uint32_t((7 * smoothed + rtt) / 8);
+            }
+            record.rttSamples = record.rttSamples + 1;
+        }
+};
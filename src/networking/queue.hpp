@@ -9,8 +9,8 @@ template <typename T> class Queue {
     private:
         std::mutex containerMutex;
         std::deque<T> container;
+        // guarded by containerMutex, so a push can not slip in between the check and the sleep
         std::condition_variable blockingCV;
-        std::mutex blockingMutex;
 
     public:
         Queue() = default;
@@ -20,10 +20,14 @@ template <typename T> class Queue {
         // basic methods encapsulating an std::deque
 
         void wait() {
-            while (empty()) {
-                std::unique_lock<std::mutex> uniqueLock(blockingMutex);
-                blockingCV.wait(uniqueLock);
-            }
+            std::unique_lock<std::mutex> uniqueLock(containerMutex);
+            blockingCV.wait(uniqueLock, [this] () { return !container.empty(); });
+        }
+
+        // returns false if the queue is still empty after 'timeout'
+        template <typename repT, typename periodT> bool wait_for(const std::chrono::duration<repT, periodT>& timeout) {
+            std::unique_lock<std::mutex> uniqueLock(containerMutex);
+            return blockingCV.wait_for(uniqueLock, timeout, [this] () { return !container.empty(); });
         }
 
         bool empty() {
@@ -47,9 +51,18 @@ template <typename T> class Queue {
         }
 
         void push_back(const T& item) {
-            std::scoped_lock lock(containerMutex);
-            container.emplace_back(std::move(item));
-            std::unique_lock<std::mutex> uniqueLock(blockingMutex);
+            {
+                std::scoped_lock lock(containerMutex);
+                container.emplace_back(std::move(item));
+            }
+            blockingCV.notify_one();
+        }
+
+        void push_back(T&& item) {
+            {
+                std::scoped_lock lock(containerMutex);
+                container.emplace_back(std::move(item));
+            }
             blockingCV.notify_one();
         }
 
@@ -66,9 +79,10 @@ template <typename T> class Queue {
         }
 
         void push_front(const T& item) {
-            std::scoped_lock lock(containerMutex);
-            container.emplace_front(std::move(item));
-            std::unique_lock<std::mutex> uniqueLock(blockingMutex);
+            {
+                std::scoped_lock lock(containerMutex);
+                container.emplace_front(std::move(item));
+            }
             blockingCV.notify_one();
         }
 
@@ -78,4 +92,21 @@ template <typename T> class Queue {
             container.pop_front();
             return x;
         }
-};
\ No newline at end of file
+
+        // returns false if the queue is empty, checks and pops under a single lock
+        bool try_pop(T& item) {
+            std::scoped_lock lock(containerMutex);
+            if (container.empty()) return false;
+            item = std::move(container.front());
+            container.pop_front();
+            return true;
+        }
+
+        // moves up to 'max' items from the front to the back of 'out' under a single lock
+        size_t drain(std::vector<T>& out, size_t max = -1) {
+            std::scoped_lock lock(containerMutex);
+            size_t n = std::min(max, container.size());
+            std::move(container.begin(), container.begin() + n, std::back_inserter(out));
+            container.erase(container.begin(), container.begin() + n);
+            return n;
+        }};
@@ -0,0 +1,233 @@
+// Copyright (c) 2022 Dániel Gergely, Dénes Balogh
+// Distributed under the MIT License.
+
+#pragma once
+#include "common.hpp"
+
+// outgoing packets are queued by lanes, a lane is not held back by the packets of the lanes after it
+namespace packetLanes {
+    // handshake and other packets of the protocol itself, always written first
+    const size_t control = 0;
+    const size_t interactive = 1;
+    const size_t bulk = 2;
+
+    const size_t count = 3;
+    // fragments a lane may write in each round of the scheduler, the control lane is not weighted
+    const std::array<size_t, count> weights = { 0, 4, 1 };
+}
+
+// compile-time description of a packet type
+// 'payloadT' is the fixed layout of the body, void for variable length bodies
+// '_lane' is the outgoing lane of the packet type
+template <auto _type, size_t _minSize, size_t _maxSize, typename payloadT = void, size_t _lane = packetLanes::interactive> struct PacketSpec {
+    static constexpr auto type = _type;
+    static constexpr size_t minSize = _minSize;
+    static constexpr size_t maxSize = _maxSize;
+    static constexpr size_t lane = _lane;
+    using payload = payloadT;
+
+    static_assert(minSize <= maxSize, "Minimum size of packet type is larger than its maximum size");
+    static_assert(lane < packetLanes::count, "Unknown lane");
+};
+
+// the body of the packet is exactly one payload struct
+template <auto _type, typename payloadT, size_t _lane = packetLanes::interactive> struct FixedPacket 
+    : PacketSpec<_type, sizeof(payloadT), sizeof(payloadT), payloadT, _lane> {
+    static_assert(std::is_trivially_copyable<payloadT>::value, "Payload is too complex to be sent as it is");
+};
+
+// the body of the packet is a byte sequence within the bounds
+template <auto _type, size_t _minSize, size_t _maxSize, size_t _lane = packetLanes::interactive> struct VariablePacket 
+    : PacketSpec<_type, _minSize, _maxSize, void, _lane> {};
+
+// optional wire features, both nodes have to support one to use it on their connection
+namespace nodeCapabilities {
+    // bodies may be sent compressed
+    const uint32_t compression = 1 << 0;
+    // queued packets are written in batches
+    const uint32_t batching = 1 << 1;
+    // large bodies are split into fragments, which are interleaved with the packets of the other lanes
+    const uint32_t multiplexing = 1 << 2;
+
+    const uint32_t all = compression | batching | multiplexing;
+}
+
+// body of the handshake: public key of the sender, its protocol version, 
+// the wire features it supports and its limits
+// integers are big-endian and unaligned, so the struct has no padding
+struct ValidationPayload {
+    char publicKey[5];
+    char protocolVersion[sizeof(NODE_VERSION)];
+    boost::endian::big_uint32_t capabilities;
+    // largest body the sender accepts
+    boost::endian::big_uint32_t maxFrameSize;
+    // port the sender listens on, so the remote node can connect to it later
+    // appended to the first version of the payload, older nodes do not send it
+    boost::endian::big_uint16_t port;
+};
+
+// the first version of the payload ends here, every node sends at least this much
+const size_t MIN_VALIDATION_BODY_SIZE = offsetof(ValidationPayload, port);
+
+// the node validation packet type has to be registered with this spec
+// the handshake changes without a version bump: fields are only ever appended to the payload,
+// a body longer than the payload known by this node is accepted and the fields after it are ignored,
+// a shorter one is accepted down to the first version, the fields it lacks are read as zero
+template <auto _type> struct ValidationPacket 
+    : PacketSpec<_type, MIN_VALIDATION_BODY_SIZE, MAX_VALIDATION_BODY_SIZE, ValidationPayload, packetLanes::control> {
+    static_assert(std::is_trivially_copyable<ValidationPayload>::value, "Payload is too complex to be sent as it is");
+};
+
+// address of a node as it is sent in the packets of the dht, the ip address is text, so it may be ipv6 too
+struct DHTContact {
+    char publicKey[5];
+    char ipAddress[46];
+    boost::endian::big_uint16_t port;
+};
+
+// asks for the contacts a node knows closest to 'target'
+struct DHTFindNodePayload {
+    boost::endian::big_uint64_t lookupId;
+    char target[5];
+};
+
+// answer to a find node request, the contact of the target itself comes first if the node knows it
+struct DHTNodesPayload {
+    boost::endian::big_uint64_t lookupId;
+    char target[5];
+    uint8_t count;
+    DHTContact contacts[DHT_BUCKET_SIZE];
+};
+
+// asks a node to remember the address of the contact, nodes announce themselves with it
+struct DHTStorePayload {
+    DHTContact contact;
+};
+
+// the packet types of the dht have to be registered with these specs as 'dhtFindNode', 'dhtNodes' and 'dhtStore'
+// the endpoint handles them itself, and resolves unknown public keys through the dht
+template <auto _type> struct DHTFindNodePacket : FixedPacket<_type, DHTFindNodePayload, packetLanes::control> {};
+template <auto _type> struct DHTNodesPacket : FixedPacket<_type, DHTNodesPayload, packetLanes::control> {};
+template <auto _type> struct DHTStorePacket : FixedPacket<_type, DHTStorePayload, packetLanes::control> {};
+
+// asks the parent node for the address of 'target'
+struct DirectoryQueryPayload {
+    boost::endian::big_uint64_t queryId;
+    char target[5];
+};
+
+// answer of the parent node, 'contact' is only set if 'found' is
+struct DirectoryAnswerPayload {
+    boost::endian::big_uint64_t queryId;
+    char target[5];
+    uint8_t found;
+    DHTContact contact;
+};
+
+// a node of the subtree announces its address, every parent on the way up remembers and forwards it
+// the first parent fills in the ip address as it sees the node
+struct DirectoryRegisterPayload {
+    DHTContact contact;
+};
+
+// the packet types of the hierarchical directory have to be registered with these specs 
+// as 'directoryQuery', 'directoryAnswer' and 'directoryRegister'
+// nodes with a parent node resolve unknown public keys through it
+template <auto _type> struct DirectoryQueryPacket : FixedPacket<_type, DirectoryQueryPayload, packetLanes::control> {};
+template <auto _type> struct DirectoryAnswerPacket : FixedPacket<_type, DirectoryAnswerPayload, packetLanes::control> {};
+template <auto _type> struct DirectoryRegisterPacket : FixedPacket<_type, DirectoryRegisterPayload, packetLanes::control> {};
+
+// the schema of the protocol, every packet type of the enum has to be listed in order
+// header validation, size checks and the dispatch table are all generated at compile time
+template <typename pT, typename... specs> struct PacketRegistry {
+    using type = pT;
+    static constexpr size_t count = sizeof...(specs);
+
+    static constexpr std::array<size_t, count> minSizes = { specs::minSize... };
+    static constexpr std::array<size_t, count> maxSizes = { specs::maxSize... };
+    static constexpr std::array<size_t, count> lanes = { specs::lane... };
+
+    // the value of the packet type is used as the index of the tables
+    static constexpr bool isOrdered() {
+        size_t i = 0;
+        return ((size_t(specs::type) == i++) && ...);
+    }
+
+    static_assert(isOrdered(), "Packet specs have to be listed in the order of the packet type enum");
+
+    // spec belonging to a packet type
+    template <pT packetType> using spec = std::tuple_element_t<size_t(packetType), std::tuple<specs...>>;
+
+    static_assert(
+        std::is_same<typename spec<pT::nodeValidation>::payload, ValidationPayload>::value,
+        "Node validation packet type has to be registered as ValidationPacket"
+    );
+
+    // whether the protocol contains the packet types of the dht
+    static constexpr bool hasDHT = requires { pT::dhtFindNode; pT::dhtNodes; pT::dhtStore; };
+
+    static constexpr bool isDHTRegistered() {
+        if constexpr (hasDHT) {
+            return std::is_same<typename spec<pT::dhtFindNode>::payload, DHTFindNodePayload>::value
+                && std::is_same<typename spec<pT::dhtNodes>::payload, DHTNodesPayload>::value
+                && std::is_same<typename spec<pT::dhtStore>::payload, DHTStorePayload>::value;
+        }
+        return true;
+    }
+
+    static_assert(isDHTRegistered(), "Packet types of the dht have to be registered as DHTFindNodePacket, DHTNodesPacket and DHTStorePacket");
+
+    // whether the protocol contains the packet types of the hierarchical directory
+    static constexpr bool hasDirectory = requires { pT::directoryQuery; pT::directoryAnswer; pT::directoryRegister; };
+
+    static constexpr bool isDirectoryRegistered() {
+        if constexpr (hasDirectory) {
+            return std::is_same<typename spec<pT::directoryQuery>::payload, DirectoryQueryPayload>::value
+                && std::is_same<typename spec<pT::directoryAnswer>::payload, DirectoryAnswerPayload>::value
+                && std::is_same<typename spec<pT::directoryRegister>::payload, DirectoryRegisterPayload>::value;
+        }
+        return true;
+    }
+
+    static_assert(
+        isDirectoryRegistered(), 
+        "Packet types of the directory have to be registered as DirectoryQueryPacket, DirectoryAnswerPacket and DirectoryRegisterPacket"
+    );
+
+    static constexpr bool isKnown(pT packetType) {
+        return size_t(packetType) < count;
+    }
+
+    // the packet type has to be known
+    static constexpr size_t laneOf(pT packetType) {
+        return lanes[size_t(packetType)];
+    }
+
+    // header validation, the type has to be known and the body has to fit its bounds
+    static constexpr bool isValid(pT packetType, size_t bodySize) {
+        return isKnown(packetType)
+            && bodySize >= minSizes[size_t(packetType)]
+            && bodySize <= maxSizes[size_t(packetType)];
+    }
+
+    // calls 'handler.onMessage(spec{}, packet)' of the packet's type through a jump table
+    // packet types the handler has no 'onMessage' for go to 'handler.onProtocolMessage(spec{}, packet)',
+    // where the endpoint handles the packet types of its own protocols, the rest end up in 'handler.onUnhandled(packet)'
+    // the packet type has to be validated before dispatching
+    template <typename handlerT, typename packetT> static void dispatch(handlerT& handler, packetT& packet) {
+        static constexpr std::array<void (*)(handlerT&, packetT&), count> table = {
+            &call<specs, handlerT, packetT>...
+        };
+        table[size_t(packet.content.header.packetType)](handler, packet);
+    }
+
+    template <typename specT, typename handlerT, typename packetT> static void call(handlerT& handler, packetT& packet) {
+        if constexpr (requires { handler.onMessage(specT{}, packet); }) {
+            handler.onMessage(specT{}, packet);
+        } else if constexpr (requires { handler.onProtocolMessage(specT{}, packet); }) {
+            handler.onProtocolMessage(specT{}, packet);
+        } else {
+            handler.onUnhandled(packet);
+        }
+    }
+};
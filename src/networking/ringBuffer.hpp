@@ -0,0 +1,55 @@
+// Copyright (c) 2022 Dániel Gergely, Dénes Balogh
+// Distributed under the MIT License.
+
+#pragma once
+#include "common.hpp"
+
+// single-threaded queue over a growing circular buffer
+// unlike std::deque it keeps its storage when emptied, so a warmed up queue does not allocate
+// growing moves the items, references to them are only valid until the next push
+template <typename T> class RingBuffer {
+    private:
+        std::vector<T> items;
+        size_t head = 0;
+        size_t itemCount = 0;
+
+    public:
+        bool empty() const {
+            return itemCount == 0;
+        }
+
+        size_t size() const {
+            return itemCount;
+        }
+
+        // 'i' is counted from the front
+        T& operator [] (size_t i) {
+            return items[(head + i) % items.size()];
+        }
+
+        T& front() {
+            return items[head];
+        }
+
+        void push_back(T&& item) {
+            if (itemCount == items.size()) grow();
+            items[(head + itemCount) % items.size()] = std::move(item);
+            itemCount++;
+        }
+
+        // removes 'n' items from the front, their slots are reset to release what the items held
+        void pop_front(size_t n = 1) {
+            n = std::min(n, itemCount);
+            for (size_t i = 0; i < n; i++) items[(head + i) % items.size()] = T();
+            head = (head + n) % std::max<size_t>(items.size(), 1);
+            itemCount -= n;
+        }
+
+    private:
+        void grow() {
+            std::vector<T> grown(std::max<size_t>(items.size() * 2, 16));
+            for (size_t i = 0; i < itemCount; i++) grown[i] = std::move((*this)[i]);
+            items = std::move(grown);
+            head = 0;
+        }
+};
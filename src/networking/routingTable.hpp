@@ -4,76 +4,217 @@
 #pragma once
 #include "common.hpp"
 
-template <typename pT, int* pS> struct ConnectionData {
+#include <shared_mutex>
+
+template <typename pR> struct ConnectionData {
     ::ipAddress ipAddress;
     ::port port;
-    std::shared_ptr<::Connection<pT, pS>> connection;
+    std::shared_ptr<::Connection<pR>> connection;
+};
+
+// fixed-size copy of a public key, so the routing table never keeps pointers into the buffers of its callers
+struct NodeKey {
+    // 4 characters and the terminating zero
+    static constexpr size_t size = 5;
+    std::array<char, size> bytes = {};
+
+    NodeKey() = default;
+    NodeKey(const char* _publicKey) {
+        std::memcpy(bytes.data(), _publicKey, strnlen(_publicKey, size - 1));
+    }
+
+    const char* c_str() const {
+        return bytes.data();
+    }
+
+    bool operator == (const NodeKey& other) const = default;
+
+    // the bits of the key mixed with the finalizer of splitmix64
+    uint64_t hash() const {
+        uint64_t x = 0;
+        std::memcpy(&x, bytes.data(), size);
+        x += 0x9e3779b97f4a7c15;
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111eb;
+        return x ^ (x >> 31);
+    }
 };
 
-struct PublicKeyCompare {
-    bool operator() (const char* x, const char* y) const {
-        return std::strcmp(x, y);
+// for the unordered containers keyed by public keys
+struct NodeKeyHash {
+    size_t operator() (const NodeKey& key) const {
+        return key.hash();
     }
 };
 
-template <typename pT, int* pS> class RoutingTable {
+// public key -> ip, port, connection pointer
+// open addressing hash table split into shards, each behind its own reader-writer lock,
+// so lookups of different nodes, and concurrent lookups of the same node, do not wait for each other
+// entries are returned as copies, they stay valid whatever happens to the table afterwards
+template <typename pR> class RoutingTable {
     private:
-        std::mutex containerMutex;
-        std::map<
-            publicKey,
-            ConnectionData<pT, pS>,
-            PublicKeyCompare
-        > container;
-        std::condition_variable blockingCV;
-        std::mutex blockingMutex;
+        // the top bits of the hash select the shard, the bottom bits the slot within it
+        static constexpr size_t shardBits = 6;
+        static constexpr size_t shardCount = size_t(1) << shardBits;
+        // slots of an empty shard, always a power of two
+        static constexpr size_t initialSlots = 16;
+
+        struct Slot {
+            uint64_t hash = 0;
+            bool used = false;
+            NodeKey key;
+            ConnectionData<pR> data;
+        };
+
+        // aligned to a cache line, so the locks of neighbouring shards do not share one
+        struct alignas(64) Shard {
+            std::shared_mutex mutex;
+            // linear probing, entries are removed by shifting back the rest of their cluster,
+            // so there are no tombstones and a probe ends at the first unused slot
+            std::vector<Slot> slots = std::vector<Slot>(initialSlots);
+            size_t used = 0;
+        };
+
+        std::array<Shard, shardCount> shards;
+        std::atomic<size_t> nodeCount = 0;
 
     public:
         RoutingTable() = default;
         RoutingTable(const RoutingTable&) = delete;
         virtual ~RoutingTable() { clear(); }
 
-        // basic methods encapsulating an std::map
-
         bool empty() {
-            std::scoped_lock lock(containerMutex);
-            return container.empty();
+            return nodeCount == 0;
         }
 
         size_t count() {
-            std::scoped_lock lock(containerMutex);
-            return container.size();
+            return nodeCount;
         }
 
         void clear() {
-            std::scoped_lock lock(containerMutex);
-            container.clear();
+            for (Shard& shard : shards) {
+                std::unique_lock lock(shard.mutex);
+                nodeCount -= shard.used;
+                shard.slots = std::vector<Slot>(initialSlots);
+                shard.used = 0;
+            }
         }
 
+        // inserts the node or overwrites its entry
         void set(
-            publicKey _publicKey,
+            const NodeKey& _publicKey,
             ipAddress _ipAddress,
             port _port,
-            std::shared_ptr<Connection<pT, pS>> _conn = nullptr
+            std::shared_ptr<Connection<pR>> _conn = nullptr
+        ) {
+            uint64_t hash = _publicKey.hash();
+            Shard& shard = shardOf(hash);
+            std::unique_lock lock(shard.mutex);
+            Slot& slot = findOrInsert(shard, _publicKey, hash);
+            slot.data.ipAddress = std::move(_ipAddress);
+            slot.data.port = _port;
+            slot.data.connection = std::move(_conn);
+        }
+
+        // copy of the entry of the node, if there is one
+        std::optional<ConnectionData<pR>> get(
+            const NodeKey& _publicKey
+        ) {
+            uint64_t hash = _publicKey.hash();
+            Shard& shard = shardOf(hash);
+            std::shared_lock lock(shard.mutex);
+            Slot* slot = find(shard, _publicKey, hash);
+            if (!slot) {
+                return std::nullopt;
+            }
+            return slot->data;
+        }
+
+        // calls 'modify' with the entry of the node while no other thread can access it
+        // returns false if there is no such node
+        bool update(
+            const NodeKey& _publicKey,
+            const std::function<void(ConnectionData<pR>&)>& modify
         ) {
-            std::scoped_lock lock(containerMutex);
-            ConnectionData<pT, pS> node;
-            node.ipAddress = _ipAddress;
-            node.port = _port;
-            node.connection = _conn;
-            container.insert(std::pair<publicKey, ConnectionData<pT, pS>>(
-                _publicKey,
-                node
-            ));
+            uint64_t hash = _publicKey.hash();
+            Shard& shard = shardOf(hash);
+            std::unique_lock lock(shard.mutex);
+            Slot* slot = find(shard, _publicKey, hash);
+            if (!slot) {
+                return false;
+            }
+            modify(slot->data);
+            return true;
         }
 
-        ConnectionData<pT, pS>* get(
-            publicKey _publicKey
+        // returns false if there is no such node
+        bool erase(
+            const NodeKey& _publicKey
         ) {
-            std::scoped_lock lock(containerMutex);
-            auto res = container.find(_publicKey);
-            if (res == container.end()) {
-                return nullptr;
+            uint64_t hash = _publicKey.hash();
+            Shard& shard = shardOf(hash);
+            std::unique_lock lock(shard.mutex);
+            Slot* slot = find(shard, _publicKey, hash);
+            if (!slot) {
+                return false;
+            }
+            removeSlot(shard, slot - shard.slots.data());
+            return true;
+        }
+
+    private:
+        Shard& shardOf(uint64_t hash) {
+            return shards[hash >> (64 - shardBits)];
+        }
+
+        Slot* find(Shard& shard, const NodeKey& key, uint64_t hash) {
+            size_t mask = shard.slots.size() - 1;
+            for (size_t i = hash & mask; shard.slots[i].used; i = (i + 1) & mask) {
+                if (shard.slots[i].hash == hash && shard.slots[i].key == key) return &shard.slots[i];
             }
-            return &(res->second);
+            return nullptr;
         }
-};
\ No newline at end of file
+
+        // the shard is grown while it is at most 3/4 full
+        Slot& findOrInsert(Shard& shard, const NodeKey& key, uint64_t hash) {
+            if (Slot* slot = find(shard, key, hash)) return *slot;
+            if ((shard.used + 1) * 4 > shard.slots.size() * 3) grow(shard);
+            size_t mask = shard.slots.size() - 1;
+            size_t i = hash & mask;
+            while (shard.slots[i].used) i = (i + 1) & mask;
+            shard.slots[i].used = true;
+            shard.slots[i].hash = hash;
+            shard.slots[i].key = key;
+            shard.used++;
+            nodeCount++;
+            return shard.slots[i];
+        }
+
+        void grow(Shard& shard) {
+            std::vector<Slot> grown(shard.slots.size() * 2);
+            size_t mask = grown.size() - 1;
+            for (Slot& slot : shard.slots) {
+                if (!slot.used) continue;
+                size_t i = slot.hash & mask;
+                while (grown[i].used) i = (i + 1) & mask;
+                grown[i] = std::move(slot);
+            }
+            shard.slots = std::move(grown);
+        }
+
+        // moves back the entries of the cluster that would become unreachable through the emptied slot
+        void removeSlot(Shard& shard, size_t emptied) {
+            size_t mask = shard.slots.size() - 1;
+            for (size_t i = (emptied + 1) & mask; shard.slots[i].used; i = (i + 1) & mask) {
+                size_t home = shard.slots[i].hash & mask;
+                // the entry may fill the emptied slot if that is not before its home slot in the probe order
+                if (((i - home) & mask) >= ((i - emptied) & mask)) {
+                    shard.slots[emptied] = std::move(shard.slots[i]);
+                    emptied = i;
+                }
+            }
+            shard.slots[emptied] = Slot();
+            shard.used--;
+            nodeCount--;
+        }
+};
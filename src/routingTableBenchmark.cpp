@@ -0,0 +1,118 @@
+// Copyright (c) 2022 Dániel Gergely, Dénes Balogh
+// Distributed under the MIT License.
+
+#define NODE_VERSION "axolotl_alpha"
+
+#include <random>
+
+#include "cli/common.hpp"
+#include "networking/common.hpp"
+using namespace cli;
+
+enum class pT : uint8_t {
+    nodeValidation,
+    textMessage
+};
+
+typedef ValidationPacket<pT::nodeValidation> NodeValidation;
+struct TextMessage : VariablePacket<pT::textMessage, 0, 256> {};
+typedef PacketRegistry<pT, NodeValidation, TextMessage> pR;
+
+const size_t lookupCount = 1000000;
+// the results of the lookups add up here, so they are not optimized away
+size_t checksum = 0;
+
+// the routing table before RoutingTable, a std::map keyed by std::string behind one mutex
+class MapTable {
+    private:
+        std::mutex containerMutex;
+        std::map<std::string, ConnectionData<pR>> container;
+
+    public:
+        void set(const char* publicKey, const std::string& ipAddress, uint16_t port) {
+            std::scoped_lock lock(containerMutex);
+            container[publicKey] = ConnectionData<pR>{ ipAddress, port, nullptr };
+        }
+
+        std::optional<ConnectionData<pR>> get(const char* publicKey) {
+            std::scoped_lock lock(containerMutex);
+            auto it = container.find(publicKey);
+            if (it == container.end()) return std::nullopt;
+            return it->second;
+        }
+};
+
+// the i-th public key, 4 printable characters like the keys of the nodes
+void keyOf(size_t i, char* publicKey) {
+    for (size_t j = 0; j < 4; j++) {
+        publicKey[j] = char(33 + i % 94);
+        i /= 94;
+    }
+    publicKey[4] = '\0';
+}
+
+// nanoseconds 'operation' takes on average over 'count' calls
+template <typename operationT> double measure(size_t count, operationT operation) {
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < count; i++) operation(i);
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / count;
+}
+
+// fills both tables with 'peerCount' nodes, then looks up random ones, on a single thread
+// returns false if the table lost or invented entries
+bool run(size_t peerCount, std::mt19937_64& random) {
+    RoutingTable<pR> table;
+    MapTable mapTable;
+    char publicKey[5];
+    double tableSet = measure(peerCount, [&] (size_t i) {
+        keyOf(i, publicKey);
+        table.set(publicKey, "10.0.0.1", 4000);
+    });
+    double mapSet = measure(peerCount, [&] (size_t i) {
+        keyOf(i, publicKey);
+        mapTable.set(publicKey, "10.0.0.1", 4000);
+    });
+    std::vector<size_t> order(lookupCount);
+    for (size_t& node : order) node = random() % peerCount;
+    double tableGet = measure(lookupCount, [&] (size_t i) {
+        keyOf(order[i], publicKey);
+        checksum += table.get(publicKey)->port;
+    });
+    double mapGet = measure(lookupCount, [&] (size_t i) {
+        keyOf(order[i], publicKey);
+        checksum += mapTable.get(publicKey)->port;
+    });
+    double tableMiss = measure(lookupCount, [&] (size_t i) {
+        keyOf(order[i] + peerCount, publicKey);
+        checksum += table.get(publicKey).has_value();
+    });
+    double tableErase = measure(peerCount / 2, [&] (size_t i) {
+        keyOf(i * 2, publicKey);
+        checksum += table.erase(publicKey);
+    });
+    // every other node was erased
+    bool consistent = table.count() == peerCount - peerCount / 2;
+    for (size_t i = 0; i < peerCount && consistent; i++) {
+        keyOf(i, publicKey);
+        consistent = table.get(publicKey).has_value() == (i % 2 == 1);
+    }
+    std::ostringstream stream;
+    stream << std::fixed << std::setprecision(0) << std::setw(8) << peerCount << " peers: "
+        << "get " << tableGet << " ns (map " << mapGet << "), "
+        << "set " << tableSet << " ns (map " << mapSet << "), "
+        << "miss " << tableMiss << " ns, erase " << tableErase << " ns";
+    print::info(stream.str());
+    if (!consistent) print::error(std::to_string(peerCount) + " peers: the table does not match the nodes set and erased");
+    return consistent;
+}
+
+// routing table benchmark, compared to the std::map it replaced
+int main() {
+    print::info(std::to_string(lookupCount) + " random lookups for each size, single thread");
+    std::mt19937_64 random(1);
+    bool passed = true;
+    for (size_t peerCount : { 10000, 100000, 1000000 }) {
+        passed = run(peerCount, random) && passed;
+    }
+    return passed ? 0 : 1;
+}
@@ -1,7 +1,61 @@
+#define NODE_VERSION "axolotl_alpha"
+
 #include "cli/common.hpp"
 #include "cryptography/common.hpp"
+#include "cryptography/service.hpp"
 using namespace cli;
 
+// crypto service test, the same steps run as async jobs of the service, awaited by a coroutine on a thread pool
+// returns false if any result is wrong
+bool cryptoServiceTest() {
+    RSA::PrivateKey senderPrivate = RSA::GeneratePrivateKey();
+    RSA::PublicKey senderPublic = RSA::GeneratePublicKey(senderPrivate);
+    RSA::PrivateKey recipientPrivate = RSA::GeneratePrivateKey();
+    RSA::PublicKey recipientPublic = RSA::GeneratePublicKey(recipientPrivate);
+    RSA::PrivateKey thirdPrivate = RSA::GeneratePrivateKey();
+    RSA::PublicKey thirdPublic = RSA::GeneratePublicKey(thirdPrivate);
+
+    CryptoService service(2);
+    thread_pool callers(1);
+    std::future<bool> result = co_spawn(callers, [&] () -> awaitable<bool> {
+        bool passed = true;
+        std::string plainText = "Szia Uram!";
+
+        std::string signature = co_await service.asyncSign(plainText, senderPrivate);
+        if (!co_await service.asyncVerify(signature, plainText, senderPublic)) {
+            print::error("CryptoService: valid signature refused");
+            passed = false;
+        }
+        if (co_await service.asyncVerify(signature, plainText, thirdPublic)) {
+            print::error("CryptoService: signature accepted with the key of another party");
+            passed = false;
+        }
+
+        SealedMessage message = co_await service.asyncSeal(plainText, recipientPublic, senderPrivate);
+        if (co_await service.asyncOpen(message, recipientPrivate, senderPublic) != plainText) {
+            print::error("CryptoService: sealed message opened to a different text");
+            passed = false;
+        }
+        // a malicious third person signing the message has to be caught
+        SealedMessage forged = co_await service.asyncSeal(plainText, recipientPublic, thirdPrivate);
+        try {
+            co_await service.asyncOpen(forged, recipientPrivate, senderPublic);
+            print::error("CryptoService: forged message opened");
+            passed = false;
+        } catch (boost::system::system_error& e) {
+            if (e.code() != boost::system::errc::bad_message) {
+                print::error(std::string("CryptoService: forged message failed with ") + e.what());
+                passed = false;
+            }
+        }
+        co_return passed;
+    }, use_future);
+    bool passed = result.get();
+    callers.join();
+    print::info(std::string("CryptoService: ") + (passed ? "passed" : "failed"));
+    return passed;
+}
+
 // hybrid cipher test
 int main() {
     // generating RSA keys for both parties, normally these keys are given
@@ -95,4 +149,6 @@ int main() {
 
     // if everything went fine there are no error messages and you see the initial plain text
     print::info(plainText2);
+
+    return cryptoServiceTest() ? 0 : 1;
 }
\ No newline at end of file